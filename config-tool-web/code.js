@@ -8,7 +8,7 @@ const STICKY_FLAG = 1 << 0;
 const TAP_FLAG = 1 << 1;
 const HOLD_FLAG = 1 << 2;
 const CONFIG_SIZE = 32;
-const CONFIG_VERSION = 18;
+const CONFIG_VERSION = 19;
 const VENDOR_ID = 0xCAFE;
 const PRODUCT_ID = 0xBAF2;
 const DEFAULT_PARTIAL_SCROLL_TIMEOUT = 1000000;
@@ -24,6 +24,7 @@ const MACRO_ITEMS_IN_PACKET = 6;
 const IGNORE_AUTH_DEV_INPUTS_FLAG = 1 << 4;
 const GPIO_OUTPUT_MODE_FLAG = 1 << 5;
 const NORMALIZE_GAMEPAD_INPUTS_FLAG = 1 << 6;
+const IMMEDIATE_PROCESSING_FLAG = 1 << 7;
 const HUB_PORT_NONE = 255;
 
 const QUIRK_FLAG_RELATIVE_MASK = 0b10000000;
@@ -148,6 +149,8 @@ let config = {
     'gpio_output_mode': 0,
     'input_labels': 0,
     'normalize_gamepad_inputs': true,
+    'immediate_processing': false,
+    'tick_margin_us': 0,
     mappings: [{
         'source_usage': '0x00000000',
         'target_usage': '0x00000000',
@@ -210,6 +213,8 @@ document.addEventListener("DOMContentLoaded", function () {
     document.getElementById("input_labels_modal_dropdown").addEventListener("change", input_labels_onchange("input_labels_modal_dropdown"));
     document.getElementById("ignore_auth_dev_inputs_checkbox").addEventListener("change", ignore_auth_dev_inputs_onchange);
     document.getElementById("normalize_gamepad_inputs_checkbox").addEventListener("change", normalize_gamepad_inputs_onchange);
+    document.getElementById("immediate_processing_checkbox").addEventListener("change", immediate_processing_onchange);
+    document.getElementById("tick_margin_input").addEventListener("change", tick_margin_onchange);
 
     document.getElementById("nav-monitor-tab").addEventListener("shown.bs.tab", monitor_tab_shown);
     document.getElementById("nav-monitor-tab").addEventListener("hide.bs.tab", monitor_tab_hide);
@@ -290,8 +295,8 @@ async function load_from_device() {
 
     try {
         await send_feature_command(GET_CONFIG);
-        const [config_version, flags, unmapped_passthrough_layer_mask, partial_scroll_timeout, mapping_count, our_usage_count, their_usage_count, interval_override, tap_hold_threshold, gpio_debounce_time_ms, our_descriptor_number, macro_entry_duration, quirk_count] =
-            await read_config_feature([UINT8, UINT8, UINT8, UINT32, UINT16, UINT32, UINT32, UINT8, UINT32, UINT8, UINT8, UINT8, UINT16]);
+        const [config_version, flags, unmapped_passthrough_layer_mask, partial_scroll_timeout, mapping_count, our_usage_count, their_usage_count, interval_override, tap_hold_threshold, gpio_debounce_time_ms, our_descriptor_number, macro_entry_duration, quirk_count, tick_margin] =
+            await read_config_feature([UINT8, UINT8, UINT8, UINT32, UINT16, UINT32, UINT32, UINT8, UINT32, UINT8, UINT8, UINT8, UINT16, UINT8]);
         check_received_version(config_version);
 
         config['version'] = config_version;
@@ -304,7 +309,9 @@ async function load_from_device() {
         config['ignore_auth_dev_inputs'] = !!(flags & IGNORE_AUTH_DEV_INPUTS_FLAG);
         config['gpio_output_mode'] = (flags & GPIO_OUTPUT_MODE_FLAG) ? 1 : 0;
         config['normalize_gamepad_inputs'] = !!(flags & NORMALIZE_GAMEPAD_INPUTS_FLAG);
+        config['immediate_processing'] = !!(flags & IMMEDIATE_PROCESSING_FLAG);
         config['macro_entry_duration'] = macro_entry_duration + 1;
+        config['tick_margin_us'] = tick_margin * 10;
         config['mappings'] = [];
 
         for (let i = 0; i < mapping_count; i++) {
@@ -442,7 +449,8 @@ async function save_to_device() {
         await send_feature_command(SUSPEND);
         const flags = (config['ignore_auth_dev_inputs'] ? IGNORE_AUTH_DEV_INPUTS_FLAG : 0) |
             (config['gpio_output_mode'] ? GPIO_OUTPUT_MODE_FLAG : 0) |
-            (config['normalize_gamepad_inputs'] ? NORMALIZE_GAMEPAD_INPUTS_FLAG : 0);
+            (config['normalize_gamepad_inputs'] ? NORMALIZE_GAMEPAD_INPUTS_FLAG : 0) |
+            (config['immediate_processing'] ? IMMEDIATE_PROCESSING_FLAG : 0);
         await send_feature_command(SET_CONFIG, [
             [UINT8, flags],
             [UINT8, layer_list_to_mask(config['unmapped_passthrough_layers'])],
@@ -452,6 +460,7 @@ async function save_to_device() {
             [UINT8, config['gpio_debounce_time_ms']],
             [UINT8, config['our_descriptor_number']],
             [UINT8, config['macro_entry_duration'] - 1],
+            [UINT8, Math.round(config['tick_margin_us'] / 10)],
         ]);
         await send_feature_command(CLEAR_MAPPING);
 
@@ -632,6 +641,8 @@ function set_config_ui_state() {
     document.getElementById('input_labels_dropdown').value = config['input_labels'];
     document.getElementById('input_labels_modal_dropdown').value = config['input_labels'];
     document.getElementById('normalize_gamepad_inputs_checkbox').checked = config['normalize_gamepad_inputs'];
+    document.getElementById('immediate_processing_checkbox').checked = config['immediate_processing'];
+    document.getElementById('tick_margin_input').value = config['tick_margin_us'];
 }
 
 function set_mappings_ui_state() {
@@ -764,6 +775,9 @@ function set_ui_state() {
         // set it to false to preserve previous behavior.
         config['normalize_gamepad_inputs'] = false;
     }
+    if (config['version'] < 19) {
+        config['tick_margin_us'] = 0;
+    }
     if (config['version'] < CONFIG_VERSION) {
         config['version'] = CONFIG_VERSION;
     }
@@ -1005,7 +1019,7 @@ async function check_device_version() {
     // device because it could be version X, ignore our GET_CONFIG call with version Y and
     // just happen to have Y at the right place in the buffer from some previous call done
     // by some other software.
-    for (const version of [CONFIG_VERSION, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2]) {
+    for (const version of [CONFIG_VERSION, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2]) {
         await send_feature_command(GET_CONFIG, [], version);
         const [received_version] = await read_config_feature([UINT8]);
         if (received_version == version) {
@@ -1427,6 +1441,22 @@ function normalize_gamepad_inputs_onchange() {
     config['normalize_gamepad_inputs'] = document.getElementById("normalize_gamepad_inputs_checkbox").checked;
 }
 
+function immediate_processing_onchange() {
+    config['immediate_processing'] = document.getElementById("immediate_processing_checkbox").checked;
+}
+
+function tick_margin_onchange() {
+    let value = parseInt(document.getElementById("tick_margin_input").value, 10);
+    if (isNaN(value) || (value < 0)) {
+        value = 0;
+    }
+    if (value > 2550) {
+        value = 2550;
+    }
+    config['tick_margin_us'] = Math.round(value / 10) * 10;
+    document.getElementById("tick_margin_input").value = config['tick_margin_us'];
+}
+
 function macro_entry_duration_onchange() {
     let value = parseInt(document.getElementById("macro_entry_duration_input").value, 10);
     if (isNaN(value)) {
@@ -11,7 +11,7 @@ PRODUCT_ID = 0xBAF2
 CONFIG_USAGE_PAGE = 0xFF00
 CONFIG_USAGE = 0x0020
 
-CONFIG_VERSION = 18
+CONFIG_VERSION = 19
 CONFIG_SIZE = 32
 REPORT_ID_CONFIG = 100
 
@@ -48,6 +48,17 @@ SET_MONITOR_ENABLED = 22
 CLEAR_QUIRKS = 23
 ADD_QUIRK = 24
 GET_QUIRK = 25
+GET_LATENCY_SAVED = 26
+GET_TICK_ALIGNMENT = 27
+GET_OUTPUT_QUEUE_STATS = 28
+GET_LATENCY_HISTOGRAM = 29
+RESET_LATENCY_HISTOGRAMS = 30
+GET_PROFILE = 31
+RESET_PROFILE = 32
+GET_EXPRESSION_STATS = 33
+RESET_EXPRESSION_STATS = 34
+GET_OUTPUT_QUEUE_CONFIG = 35
+SET_OUTPUT_QUEUE_CONFIG = 36
 
 PERSIST_CONFIG_SUCCESS = 1
 PERSIST_CONFIG_CONFIG_TOO_BIG = 2
@@ -61,10 +72,12 @@ HOLD_FLAG = 1 << 2
 IGNORE_AUTH_DEV_INPUTS_FLAG = 1 << 4
 GPIO_OUTPUT_MODE_FLAG = 1 << 5
 NORMALIZE_GAMEPAD_INPUTS_FLAG = 1 << 6
+IMMEDIATE_PROCESSING_FLAG = 1 << 7
 
 NMACROS = 32
 NEXPRESSIONS = 8
 MACRO_ITEMS_IN_PACKET = 6
+LATENCY_BUCKETS_IN_PACKET = 6
 
 QUIRK_FLAG_RELATIVE_MASK = 0b10000000
 QUIRK_FLAG_SIGNED_MASK = 0b01000000
@@ -10,6 +10,9 @@ commands = {
     "pair_new_device": PAIR_NEW_DEVICE,
     "clear_bonds": CLEAR_BONDS,
     "flash_b_side": FLASH_B_SIDE,
+    "reset_latency_histograms": RESET_LATENCY_HISTOGRAMS,
+    "reset_profile": RESET_PROFILE,
+    "reset_expression_stats": RESET_EXPRESSION_STATS,
 }
 
 device = get_device()
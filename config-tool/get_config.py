@@ -27,7 +27,7 @@ data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
     our_descriptor_number,
     macro_entry_duration,
     quirk_count,
-    *_,
+    tick_margin,
     crc,
 ) = struct.unpack("<BBBBLHLLBLBBBHBL", data)
 check_crc(data, crc)
@@ -45,6 +45,8 @@ config = {
     "gpio_output_mode": 1 if (flags & GPIO_OUTPUT_MODE_FLAG) else 0,
     "input_labels": 0,
     "normalize_gamepad_inputs": bool(flags & NORMALIZE_GAMEPAD_INPUTS_FLAG),
+    "immediate_processing": bool(flags & IMMEDIATE_PROCESSING_FLAG),
+    "tick_margin_us": tick_margin * 10,
     "mappings": [],
     "macros": [],
     "expressions": [],
@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+device = get_device()
+
+expr = 0
+nexpressions = 1
+frames = 0
+evaluations = []
+while expr < nexpressions:
+    data = struct.pack(
+        "<BBBL22B",
+        REPORT_ID_CONFIG,
+        CONFIG_VERSION,
+        GET_EXPRESSION_STATS,
+        expr,
+        *([0] * 22)
+    )
+    device.send_feature_report(add_crc(data))
+    data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+    (
+        report_id,
+        nexpressions,
+        returned_expr,
+        frames,
+        count,
+        *_,
+        crc,
+    ) = struct.unpack("<BBBLL18BL", data)
+    check_crc(data, crc)
+    evaluations.append(count)
+    expr += 1
+
+print("frames: {}".format(frames))
+for i, count in enumerate(evaluations):
+    print(
+        "expression {}: {} evaluations ({:.1f}% of frames)".format(
+            i + 1, count, 100.0 * count / frames if frames else 0
+        )
+    )
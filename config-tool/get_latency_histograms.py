@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+stages = [
+    "input to processing",
+    "processing",
+    "queued",
+    "usb",
+    "end to end",
+]
+
+percentiles = [50, 90, 99, 99.9]
+
+device = get_device()
+
+for stage, name in enumerate(stages):
+    counts = []
+    nbuckets = 1
+    while len(counts) < nbuckets:
+        data = struct.pack(
+            "<BBBBB24B",
+            REPORT_ID_CONFIG,
+            CONFIG_VERSION,
+            GET_LATENCY_HISTOGRAM,
+            stage,
+            len(counts),
+            *([0] * 24)
+        )
+        device.send_feature_report(add_crc(data))
+        data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+        (
+            report_id,
+            bucket_width_us,
+            nbuckets,
+            first_bucket,
+            *chunk,
+            crc,
+        ) = struct.unpack("<BHBB6LL", data)
+        check_crc(data, crc)
+        counts += chunk[: min(LATENCY_BUCKETS_IN_PACKET, nbuckets - first_bucket)]
+
+    total = sum(counts)
+    print("{} ({} samples)".format(name, total))
+    if total == 0:
+        continue
+    for i, count in enumerate(counts):
+        if count == 0:
+            continue
+        if i == nbuckets - 1:
+            label = ">= {} us".format(i * bucket_width_us)
+        else:
+            label = "{}-{} us".format(i * bucket_width_us, (i + 1) * bucket_width_us)
+        print("  {:>14} {:>10}".format(label, count))
+    for p in percentiles:
+        seen = 0
+        for i, count in enumerate(counts):
+            seen += count
+            if seen * 100 >= total * p:
+                break
+        if i == nbuckets - 1:
+            print("  p{}: >= {} us".format(p, i * bucket_width_us))
+        else:
+            print("  p{}: < {} us".format(p, (i + 1) * bucket_width_us))
@@ -0,0 +1,29 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+device = get_device()
+
+data = struct.pack(
+    "<BBB26B", REPORT_ID_CONFIG, CONFIG_VERSION, GET_LATENCY_SAVED, *([0] * 26)
+)
+device.send_feature_report(add_crc(data))
+
+data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+
+(
+    report_id,
+    immediate_runs,
+    latency_saved_us,
+    *_,
+    crc,
+) = struct.unpack("<BLQ16BL", data)
+check_crc(data, crc)
+
+print("reports processed immediately: {}".format(immediate_runs))
+if immediate_runs > 0:
+    print(
+        "average latency saved: {:.0f} us".format(latency_saved_us / immediate_runs)
+    )
@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+device = get_device()
+
+data = struct.pack(
+    "<BBB26B", REPORT_ID_CONFIG, CONFIG_VERSION, GET_OUTPUT_QUEUE_STATS, *([0] * 26)
+)
+device.send_feature_report(add_crc(data))
+
+data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+
+(
+    report_id,
+    reports_merged,
+    reports_dropped,
+    *_,
+    crc,
+) = struct.unpack("<BLL20BL", data)
+check_crc(data, crc)
+
+print("reports merged into queued ones: {}".format(reports_merged))
+print("reports dropped or held back: {}".format(reports_dropped))
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+stages = [
+    "loop",
+    "read_report",
+    "descriptor_update",
+    "read_gpio",
+    "read_adc",
+    "process_mapping",
+    "write_gpio",
+    "mcp4651_write",
+    "tud_task",
+    "serial_hid_control",
+    "send_report",
+    "send_out_report",
+    "persist_config",
+]
+
+device = get_device()
+
+stage = 0
+nstages = 1
+print(
+    "{:<20} {:>10} {:>10} {:>10} {:>10} {:>10}".format(
+        "stage", "count", "min us", "avg us", "p99 us", "max us"
+    )
+)
+while stage < nstages:
+    data = struct.pack(
+        "<BBBL22B", REPORT_ID_CONFIG, CONFIG_VERSION, GET_PROFILE, stage, *([0] * 22)
+    )
+    device.send_feature_report(add_crc(data))
+    data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+    (
+        report_id,
+        nstages,
+        returned_stage,
+        ticks_per_us,
+        count,
+        min_ticks,
+        max_ticks,
+        avg_ticks,
+        p99_ticks,
+        overruns,
+        crc,
+    ) = struct.unpack("<BBBHLLLLLLL", data)
+    check_crc(data, crc)
+    if nstages == 0:
+        raise Exception("Firmware was built without the profiler (cmake -DPROFILER=ON).")
+    name = stages[stage] if stage < len(stages) else str(stage)
+    print(
+        "{:<20} {:>10} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f}".format(
+            name,
+            count,
+            min_ticks / ticks_per_us,
+            avg_ticks / ticks_per_us,
+            p99_ticks / ticks_per_us,
+            max_ticks / ticks_per_us,
+        )
+    )
+    stage += 1
+
+print("loop iterations over 1 ms: {}".format(overruns))
@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+
+from common import *
+
+import struct
+
+device = get_device()
+
+data = struct.pack(
+    "<BBB26B", REPORT_ID_CONFIG, CONFIG_VERSION, GET_TICK_ALIGNMENT, *([0] * 26)
+)
+device.send_feature_report(add_crc(data))
+
+data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+
+(
+    report_id,
+    active,
+    tick_offset,
+    host_poll_phase,
+    tick_to_report_time,
+    *_,
+    crc,
+) = struct.unpack("<BBHHH21BL", data)
+check_crc(data, crc)
+
+print("aligned to host polling: {}".format("yes" if active else "no"))
+print("host polls at: {} us after SOF".format(host_poll_phase))
+print("tick to report ready: {} us".format(tick_to_report_time))
+print("tick fires at: {} us after SOF".format(tick_offset))
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+
+# usage: output_queue_config.py [depth [keep_edges|keep_latest]]
+#
+# Without arguments prints the current settings. They're not persisted,
+# the device goes back to its compiled-in defaults when it restarts.
+
+from common import *
+
+import sys
+import struct
+
+policies = {
+    "keep_edges": 0,
+    "keep_latest": 1,
+}
+
+device = get_device()
+
+if len(sys.argv) > 1:
+    depth = int(sys.argv[1])
+    if len(sys.argv) > 2:
+        keep_latest = policies[sys.argv[2].lower()]
+    else:
+        keep_latest = 0
+
+    data = struct.pack(
+        "<BBBBB24B",
+        REPORT_ID_CONFIG,
+        CONFIG_VERSION,
+        SET_OUTPUT_QUEUE_CONFIG,
+        depth,
+        keep_latest,
+        *([0] * 24)
+    )
+    device.send_feature_report(add_crc(data))
+
+data = struct.pack(
+    "<BBB26B", REPORT_ID_CONFIG, CONFIG_VERSION, GET_OUTPUT_QUEUE_CONFIG, *([0] * 26)
+)
+device.send_feature_report(add_crc(data))
+
+data = get_feature_report(device, REPORT_ID_CONFIG, CONFIG_SIZE + 1)
+
+(
+    report_id,
+    depth,
+    keep_latest,
+    max_depth,
+    *_,
+    crc,
+) = struct.unpack("<BBBB25BL", data)
+check_crc(data, crc)
+
+print("queue depth: {} (max {})".format(depth, max_depth))
+print("when full: {}".format("keep latest" if keep_latest else "keep edges"))
@@ -37,14 +37,17 @@ gpio_output_mode = config.get("gpio_output_mode", 0)
 normalize_gamepad_inputs = (
     config.get("normalize_gamepad_inputs", True) if version >= 18 else False
 )
+immediate_processing = config.get("immediate_processing", False)
+tick_margin = min(config.get("tick_margin_us", 0) // 10, 255)
 
 flags = 0
 flags |= IGNORE_AUTH_DEV_INPUTS_FLAG if ignore_auth_dev_inputs else 0
 flags |= GPIO_OUTPUT_MODE_FLAG if gpio_output_mode == 1 else 0
 flags |= NORMALIZE_GAMEPAD_INPUTS_FLAG if normalize_gamepad_inputs else 0
+flags |= IMMEDIATE_PROCESSING_FLAG if immediate_processing else 0
 
 data = struct.pack(
-    "<BBBBBLBLBBB12B",
+    "<BBBBBLBLBBBB11B",
     REPORT_ID_CONFIG,
     CONFIG_VERSION,
     SET_CONFIG,
@@ -56,7 +59,8 @@ data = struct.pack(
     gpio_debounce_time_ms,
     our_descriptor_number,
     macro_entry_duration,
-    *([0] * 12)
+    tick_margin,
+    *([0] * 11)
 )
 device.send_feature_report(add_crc(data))
 
@@ -0,0 +1,775 @@
+// Microbenchmarks for the hot parts of the remapping engine.
+//
+// usage: bench [-j] [-f filter] [-t min_time_ms] [-e examples.js]
+//
+// Each benchmark runs its operation until at least min_time_ms have passed
+// and reports the time and the number of heap allocations per operation.
+// -j prints the results as JSON instead of a table, -f only runs benchmarks
+// whose names contain the given string. The sample expressions are read from
+// the web config tool's examples.js.
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bits.h"
+#include "config.h"
+#include "descriptor_parser.h"
+#include "globals.h"
+#include "host.h"
+#include "our_descriptor.h"
+#include "platform.h"
+#include "quirks.h"
+#include "remapper.h"
+
+static uint64_t allocations = 0;
+static uint64_t allocated_bytes = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t size) noexcept {
+    free(ptr);
+}
+
+static const uint8_t MAPPING_FLAG_STICKY = 1 << 0;
+static const uint8_t MAPPING_FLAG_TAP = 1 << 1;
+static const uint8_t MAPPING_FLAG_HOLD = 1 << 2;
+
+static const uint8_t keyboard_descriptor[] = { 0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0 };
+static const uint8_t mouse_descriptor[] = { 0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0 };
+static const uint8_t gamepad_descriptor[] = { 0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x15, 0x00, 0x25, 0x01, 0x35, 0x00, 0x45, 0x01, 0x75, 0x01, 0x95, 0x10, 0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x81, 0x02, 0x05, 0x01, 0x25, 0x07, 0x46, 0x3B, 0x01, 0x75, 0x04, 0x95, 0x01, 0x65, 0x14, 0x09, 0x39, 0x81, 0x42, 0x65, 0x00, 0x95, 0x01, 0x81, 0x01, 0x26, 0xFF, 0x00, 0x46, 0xFF, 0x00, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35, 0x75, 0x08, 0x95, 0x04, 0x81, 0x02, 0xC0 };
+static const uint8_t nkro_descriptor[] = { 0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0x00, 0x29, 0x77, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x78, 0x81, 0x02, 0xC0 };
+
+struct device_t {
+    const char* name;
+    uint16_t interface;
+    uint8_t hub_port;
+    const uint8_t* descriptor;
+    uint16_t descriptor_len;
+    // two reports to alternate between, so that every report changes something
+    uint8_t report_len;
+    uint8_t reports[2][16];
+};
+
+static const device_t devices[] = {
+    { "keyboard", 0x0100, 1, keyboard_descriptor, sizeof(keyboard_descriptor), 8,
+        { { 0x02, 0x00, 0x04, 0x05, 0x00, 0x00, 0x00, 0x00 },
+            { 0x00, 0x00, 0x04, 0x16, 0x07, 0x00, 0x00, 0x00 } } },
+    { "mouse", 0x0200, 2, mouse_descriptor, sizeof(mouse_descriptor), 6,
+        { { 0x01, 0x05, 0x00, 0xFB, 0xFF, 0x00 },
+            { 0x00, 0xFD, 0xFF, 0x02, 0x00, 0x01 } } },
+    { "gamepad", 0x0300, 3, gamepad_descriptor, sizeof(gamepad_descriptor), 7,
+        { { 0x01, 0x00, 0x08, 0x80, 0x80, 0x80, 0x80 },
+            { 0x00, 0x02, 0x02, 0x20, 0xE0, 0x80, 0x10 } } },
+    { "nkro", 0x0400, 0, nkro_descriptor, sizeof(nkro_descriptor), 16,
+        { { 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00 },
+            { 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80 } } },
+};
+
+static const char* op_names[] = {
+    "push", "push_usage", "input_state", "add", "mul", "eq", "time", "mod", "gt", "not",
+    "input_state_binary", "abs", "dup", "sin", "cos", "debug", "auto_repeat", "relu", "clamp", "scaling",
+    "layer_state", "sticky_state", "tap_state", "hold_state", "bitwise_or", "bitwise_and", "bitwise_not", "prev_input_state", "prev_input_state_binary", "store",
+    "recall", "sqrt", "atan2", "round", "port", "dpad", "eol", "input_state_fp32", "prev_input_state_fp32", "min",
+    "max", "ifte", "div", "swap", "monitor", "sign", "sub", "print_if", "time_sec", "lt",
+    "plugged_in", "input_state_scaled", "prev_input_state_scaled", "deadzone", "deadzone2",
+};
+
+#define X "0x00010030 input_state "
+#define Y "0x00010031 input_state "
+
+// One expression for every op that can appear in a config, with inputs that
+// can't be folded at compile time. debug and print_if are left out because
+// they print, the modulus is a constant because the inputs can be zero.
+static const char* op_expressions[][2] = {
+    { "push", "1000" },
+    { "push_usage", "0x00010030" },
+    { "input_state", X },
+    { "add", X Y "add" },
+    { "mul", X Y "mul" },
+    { "eq", X Y "eq" },
+    { "time", "time" },
+    { "mod", X "7000 mod" },
+    { "gt", X Y "gt" },
+    { "not", X "not" },
+    { "input_state_binary", "0x00090001 input_state_binary" },
+    { "abs", X "abs" },
+    { "dup", X "dup" },
+    { "sin", X "sin" },
+    { "cos", X "cos" },
+    { "auto_repeat", "auto_repeat" },
+    { "relu", X "relu" },
+    { "clamp", X Y "0x00010032 input_state clamp" },
+    { "scaling", "scaling" },
+    { "layer_state", "layer_state" },
+    { "sticky_state", "0x00070004 sticky_state" },
+    { "tap_state", "0x00070004 tap_state" },
+    { "hold_state", "0x00070004 hold_state" },
+    { "bitwise_or", X Y "bitwise_or" },
+    { "bitwise_and", X Y "bitwise_and" },
+    { "bitwise_not", X "bitwise_not" },
+    { "prev_input_state", "0x00010030 prev_input_state" },
+    { "prev_input_state_binary", "0x00090001 prev_input_state_binary" },
+    { "store", X "1000 store" },
+    { "recall", "1000 recall" },
+    { "sqrt", X "abs sqrt" },
+    { "atan2", X Y "atan2" },
+    { "round", X "round" },
+    { "port", "1000 port " X "0 port" },
+    { "dpad", X Y "0x00010032 input_state 0x00010035 input_state dpad" },
+    { "eol", X "eol" },
+    { "input_state_fp32", "0x00010030 input_state_fp32" },
+    { "prev_input_state_fp32", "0x00010030 prev_input_state_fp32" },
+    { "min", X Y "min" },
+    { "max", X Y "max" },
+    { "ifte", X Y "0x00010032 input_state ifte" },
+    { "div", X Y "div" },
+    { "swap", X Y "swap" },
+    { "monitor", X "0x00010030 monitor" },
+    { "sign", X "sign" },
+    { "sub", X Y "sub" },
+    { "time_sec", "time_sec" },
+    { "lt", X Y "lt" },
+    { "plugged_in", "plugged_in" },
+    { "input_state_scaled", "0x00010030 input_state_scaled" },
+    { "prev_input_state_scaled", "0x00010030 prev_input_state_scaled" },
+    { "deadzone", X Y "0x00010032 input_state deadzone" },
+    { "deadzone2", X Y "0x00010032 input_state 0x00010035 input_state deadzone2" },
+};
+
+#undef X
+#undef Y
+
+struct example_t {
+    std::string description;
+    uint8_t unmapped_passthrough_layer_mask;
+    std::vector<mapping_config11_t> mappings;
+    std::vector<std::string> expressions;
+};
+
+struct result_t {
+    std::string name;
+    std::string description;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+static std::vector<result_t> results;
+static const char* filter = NULL;
+static uint64_t min_time_ns = 200000000;
+static volatile int32_t sink;
+
+template <typename F>
+static void run(const std::string& name, F op, const std::string& description = "") {
+    if ((filter != NULL) && (name.find(filter) == std::string::npos)) {
+        return;
+    }
+
+    op();  // warm up caches and lazily resolved state pointers
+
+    uint64_t iterations = 1;
+    while (true) {
+        uint64_t allocations_before = allocations;
+        uint64_t allocated_bytes_before = allocated_bytes;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            op();
+        }
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if ((elapsed >= min_time_ns) || (iterations >= (1ull << 32))) {
+            results.push_back((result_t){
+                .name = name,
+                .description = description,
+                .iterations = iterations,
+                .ns_per_op = (double) elapsed / iterations,
+                .allocs_per_op = (double) (allocations - allocations_before) / iterations,
+                .bytes_per_op = (double) (allocated_bytes - allocated_bytes_before) / iterations,
+            });
+            if (!isatty(STDOUT_FILENO)) {
+                fprintf(stderr, "%s\n", name.c_str());
+            }
+            return;
+        }
+        // aim a bit past the target so that we usually only need one more round
+        uint64_t next = (elapsed > 0) ? iterations * 1.2 * min_time_ns / elapsed : iterations * 100;
+        iterations = (next > iterations * 100) ? iterations * 100 : (next > iterations) ? next : iterations * 2;
+    }
+}
+
+static bool parse_expression(const std::string& text, std::vector<expr_elem_t>& elems) {
+    std::string code;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t comment = text.find("/*", pos);
+        if (comment == std::string::npos) {
+            code += text.substr(pos);
+            break;
+        }
+        code += text.substr(pos, comment - pos) + " ";
+        size_t comment_end = text.find("*/", comment + 2);
+        pos = (comment_end == std::string::npos) ? text.size() : comment_end + 2;
+    }
+
+    std::istringstream ss(code);
+    std::string token;
+    elems.clear();
+    while (ss >> token) {
+        if ((token.size() > 2) && (token[0] == '0') && ((token[1] == 'x') || (token[1] == 'X'))) {
+            elems.push_back((expr_elem_t){ .op = Op::PUSH_USAGE, .val = (uint32_t) strtoul(token.c_str(), NULL, 16) });
+            continue;
+        }
+        if (((token[0] >= '0') && (token[0] <= '9')) || (token[0] == '-')) {
+            elems.push_back((expr_elem_t){ .op = Op::PUSH, .val = (uint32_t) strtol(token.c_str(), NULL, 10) });
+            continue;
+        }
+        for (auto& c : token) {
+            c = tolower(c);
+        }
+        bool found = false;
+        for (unsigned int i = 0; i < sizeof(op_names) / sizeof(op_names[0]); i++) {
+            if (token == op_names[i]) {
+                elems.push_back((expr_elem_t){ .op = (Op) i });
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "unknown op in expression: %s\n", token.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads a double quoted string starting at pos, leaves pos after the closing quote.
+static std::string read_string(const std::string& s, size_t& pos) {
+    std::string ret;
+    pos++;
+    while ((pos < s.size()) && (s[pos] != '"')) {
+        if ((s[pos] == '\\') && (pos + 1 < s.size())) {
+            pos++;
+            ret += (s[pos] == 'n') ? '\n' : s[pos];
+        } else {
+            ret += s[pos];
+        }
+        pos++;
+    }
+    pos++;
+    return ret;
+}
+
+// Value of "key" in a flat JSON object, strings without the quotes, lists without the brackets.
+static bool json_value(const std::string& object, const char* key, std::string& value) {
+    size_t pos = object.find(std::string("\"") + key + "\":");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = object.find_first_not_of(" \t\r\n", pos + strlen(key) + 3);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    if (object[pos] == '"') {
+        value = read_string(object, pos);
+        return true;
+    }
+    size_t end = (object[pos] == '[') ? object.find(']', pos) : object.find_first_of(",}\r\n", pos);
+    if (end == std::string::npos) {
+        end = object.size();
+    }
+    value = object.substr((object[pos] == '[') ? pos + 1 : pos, end - ((object[pos] == '[') ? pos + 1 : pos));
+    return true;
+}
+
+static uint8_t layer_list_to_mask(const std::string& list) {
+    uint8_t mask = 0;
+    std::string item;
+    std::istringstream ss(list);
+    while (std::getline(ss, item, ',')) {
+        if (item.find_first_of("0123456789") != std::string::npos) {
+            mask |= 1 << atoi(item.c_str());
+        }
+    }
+    return mask;
+}
+
+// Closing bracket of the JSON list that starts at pos, skipping over strings.
+static size_t list_end(const std::string& s, size_t pos) {
+    int depth = 0;
+    while (pos < s.size()) {
+        if (s[pos] == '"') {
+            read_string(s, pos);
+            continue;
+        }
+        if ((s[pos] == '[') || (s[pos] == '{')) {
+            depth++;
+        } else if ((s[pos] == ']') || (s[pos] == '}')) {
+            if (--depth == 0) {
+                return pos;
+            }
+        }
+        pos++;
+    }
+    return s.size();
+}
+
+static mapping_config11_t parse_mapping(const std::string& object) {
+    std::string value;
+    mapping_config11_t mapping = {
+        .scaling = 1000,
+        .layer_mask = 1,
+        .flags = 0,
+    };
+    if (json_value(object, "source_usage", value)) {
+        mapping.source_usage = strtoul(value.c_str(), NULL, 16);
+    }
+    if (json_value(object, "target_usage", value)) {
+        mapping.target_usage = strtoul(value.c_str(), NULL, 16);
+    }
+    if (json_value(object, "scaling", value)) {
+        mapping.scaling = atoi(value.c_str());
+    }
+    if (json_value(object, "layers", value)) {
+        mapping.layer_mask = layer_list_to_mask(value);
+    } else if (json_value(object, "layer", value)) {
+        mapping.layer_mask = 1 << atoi(value.c_str());
+    }
+    if (json_value(object, "sticky", value) && (value == "true")) {
+        mapping.flags |= MAPPING_FLAG_STICKY;
+    }
+    if (json_value(object, "tap", value) && (value == "true")) {
+        mapping.flags |= MAPPING_FLAG_TAP;
+    }
+    if (json_value(object, "hold", value) && (value == "true")) {
+        mapping.flags |= MAPPING_FLAG_HOLD;
+    }
+    uint8_t source_port = json_value(object, "source_port", value) ? atoi(value.c_str()) : 0;
+    uint8_t target_port = json_value(object, "target_port", value) ? atoi(value.c_str()) : 0;
+    mapping.hub_ports = ((target_port & 0x0F) << 4) | (source_port & 0x0F);
+    return mapping;
+}
+
+// Only picks out what the benchmarks need: mappings, expressions and the
+// unmapped passthrough layers. Macros are ignored.
+static bool read_examples(const char* filename, std::vector<example_t>& examples) {
+    std::ifstream f(filename);
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", filename);
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << f.rdbuf();
+    const std::string s = buffer.str();
+
+    const std::string description_key = "'description': '";
+    size_t pos = s.find(description_key);
+    while (pos != std::string::npos) {
+        size_t start = pos + description_key.size();
+        size_t next = s.find(description_key, start);
+        std::string block = s.substr(start, (next == std::string::npos) ? std::string::npos : next - start);
+        pos = next;
+
+        example_t example;
+        example.description = block.substr(0, block.find('\''));
+
+        std::string value;
+        if (json_value(block, "unmapped_passthrough_layers", value)) {
+            example.unmapped_passthrough_layer_mask = layer_list_to_mask(value);
+        } else {
+            example.unmapped_passthrough_layer_mask = (json_value(block, "unmapped_passthrough", value) && (value == "true")) ? 1 : 0;
+        }
+
+        size_t list = block.find("\"mappings\":");
+        if (list != std::string::npos) {
+            list = block.find('[', list);
+            size_t end = list_end(block, list);
+            size_t object = block.find('{', list);
+            while (object < end) {
+                size_t object_end = list_end(block, object);
+                example.mappings.push_back(parse_mapping(block.substr(object, object_end - object + 1)));
+                object = block.find('{', object_end);
+            }
+        }
+
+        list = block.find("\"expressions\":");
+        if (list != std::string::npos) {
+            list = block.find('[', list);
+            size_t end = list_end(block, list);
+            size_t str = block.find('"', list);
+            while (str < end) {
+                example.expressions.push_back(read_string(block, str));
+                str = block.find('"', str);
+            }
+        }
+
+        examples.push_back(example);
+    }
+    return true;
+}
+
+static void connect_devices() {
+    for (auto const& device : devices) {
+        parse_descriptor(0x1234, 0x5678, device.descriptor, device.descriptor_len, device.interface, 0);
+        device_connected_callback(device.interface, 0x1234, 0x5678, device.hub_port);
+    }
+}
+
+static void apply_config() {
+    set_mapping_from_config();
+    if (their_descriptor_updated) {
+        update_their_descriptor_derivates();
+        their_descriptor_updated = false;
+    }
+}
+
+static void clear_config() {
+    config_mappings.clear();
+    for (int i = 0; i < NMACROS; i++) {
+        macros[i].clear();
+    }
+    for (int i = 0; i < NEXPRESSIONS; i++) {
+        expressions[i].clear();
+    }
+    unmapped_passthrough_layer_mask = 0;
+}
+
+static const uint32_t synthetic_sources[] = {
+    0x00070004, 0x00070005, 0x00070006, 0x00070007, 0x00070008, 0x00070009, 0x0007000a, 0x0007000b,
+    0x0007000c, 0x0007000d, 0x0007000e, 0x0007000f, 0x00070010, 0x00070011, 0x00070012, 0x00070013,
+    0x000700e0, 0x000700e1, 0x000700e2, 0x000700e3,
+    0x00090001, 0x00090002, 0x00090003, 0x00090004, 0x00090005, 0x00090006, 0x00090007, 0x00090008,
+    0x00010030, 0x00010031, 0x00010032, 0x00010035, 0x00010038, 0x00010039,
+};
+
+static const uint32_t synthetic_targets[] = {
+    0x00070004, 0x00070016, 0x00070007, 0x0007001a, 0x00070028, 0x0007002c, 0x0007004f, 0x00070050,
+    0x00070051, 0x00070052, 0x000700e0, 0x000700e1, 0x00090001, 0x00090002, 0x00090003,
+    0x00010030, 0x00010031, 0x00010038, 0x000c0238,
+};
+
+// Every source and target gets used, every eighth mapping is on layer 1
+// and every tenth one is sticky.
+static void synthetic_config(unsigned int nmappings) {
+    clear_config();
+    unmapped_passthrough_layer_mask = 1;
+    const unsigned int nsources = sizeof(synthetic_sources) / sizeof(synthetic_sources[0]);
+    const unsigned int ntargets = sizeof(synthetic_targets) / sizeof(synthetic_targets[0]);
+    for (unsigned int i = 0; i < nmappings; i++) {
+        config_mappings.push_back((mapping_config11_t){
+            .target_usage = synthetic_targets[(i * 7) % ntargets],
+            .source_usage = synthetic_sources[i % nsources],
+            .scaling = (i % 3 == 0) ? 500 : 1000,
+            .layer_mask = (uint8_t) ((i % 8 == 7) ? 0b10 : 0b01),
+            .flags = (uint8_t) ((i % 10 == 9) ? MAPPING_FLAG_STICKY : 0),
+            .hub_ports = (uint8_t) ((i / nsources) % 4),
+        });
+    }
+    apply_config();
+}
+
+static bool discard_report(uint8_t interface, const uint8_t* report_with_id, uint8_t len) {
+    return true;
+}
+
+// bitpos and size of fields as they come in typical reports; the last one
+// runs past the end of the report and goes through the bit loop
+static const struct {
+    const char* name;
+    uint16_t bitpos;
+    uint8_t size;
+} bits_fields[] = {
+    { "bit", 13, 1 },
+    { "uint8", 24, 8 },
+    { "uint16", 16, 16 },
+    { "uint32", 32, 32 },
+    { "generic12", 12, 12 },
+    { "past_end", 60, 16 },
+};
+
+static uint8_t bits_report[8];
+
+static void bench_bits() {
+    for (auto const& field : bits_fields) {
+        BitsKernel kernel = bits_kernel(field.bitpos, field.size);
+        uint32_t n = 0;
+        run(std::string("get_bits/") + field.name, [&field, kernel, &n]() {
+            n++;
+            bits_report[n & 7] = n;
+            sink = get_bits(kernel, bits_report, sizeof(bits_report), field.bitpos, field.size);
+        });
+        run(std::string("get_bits_slow/") + field.name, [&field, &n]() {
+            n++;
+            bits_report[n & 7] = n;
+            sink = get_bits_slow(bits_report, sizeof(bits_report), field.bitpos, field.size);
+        });
+        run(std::string("put_bits/") + field.name, [&field, kernel, &n]() {
+            put_bits(kernel, bits_report, sizeof(bits_report), field.bitpos, field.size, n++);
+        });
+        run(std::string("put_bits_slow/") + field.name, [&field, &n]() {
+            put_bits_slow(bits_report, sizeof(bits_report), field.bitpos, field.size, n++);
+        });
+    }
+}
+
+static void bench_process_mapping() {
+    static const unsigned int sizes[] = { 10, 100, 500 };
+    for (unsigned int nmappings : sizes) {
+        synthetic_config(nmappings);
+        std::string prefix = "process_mapping/" + std::to_string(nmappings);
+
+        run(prefix + "/idle", []() {
+            host_time += 1000;
+            process_mapping(true);
+        });
+
+        // a key and mouse movement change every frame, everything that
+        // comes out gets sent right away
+        uint32_t n = 0;
+        run(prefix + "/active", [&n]() {
+            host_time += 1000;
+            n++;
+            set_input_state(synthetic_sources[n % 16], n & 1, (n & 1) * 1000);
+            set_input_state(0x00010030, 3, 3000);
+            set_input_state(0x00010031, -2, -2000);
+            process_mapping(true);
+            while (send_report(discard_report)) {
+            }
+        });
+
+        // holding and releasing a key that activates layer 1, so the
+        // sources on the active layers change every frame
+        config_mappings.push_back((mapping_config11_t){
+            .target_usage = 0xFFF10001,
+            .source_usage = 0x000700e4,
+            .scaling = 1000,
+            .layer_mask = 0b11,
+        });
+        apply_config();
+        run(prefix + "/layer_switch", [&n]() {
+            host_time += 1000;
+            n++;
+            set_input_state(0x000700e4, n & 1, (n & 1) * 1000);
+            process_mapping(true);
+            while (send_report(discard_report)) {
+            }
+        });
+    }
+}
+
+static void bench_eval_expr_ops() {
+    synthetic_config(10);
+    for (auto const& op_expression : op_expressions) {
+        clear_config();
+        if (!parse_expression(op_expression[1], expressions[0])) {
+            continue;
+        }
+        apply_config();
+        set_input_state(0x00010030, 120, 120);
+        set_input_state(0x00010031, -45, -45);
+        set_input_state(0x00010032, 30, 30);
+        set_input_state(0x00010035, 200, 200);
+        run(std::string("eval_expr/op/") + op_expression[0], []() {
+            host_time += 1000;
+            sink = eval_expr(0, host_time, true);
+        });
+    }
+}
+
+static void bench_eval_expr_examples(const std::vector<example_t>& examples) {
+    for (unsigned int i = 0; i < examples.size(); i++) {
+        const example_t& example = examples[i];
+        clear_config();
+        unmapped_passthrough_layer_mask = example.unmapped_passthrough_layer_mask;
+        config_mappings = example.mappings;
+        bool any = false;
+        bool ok = true;
+        for (unsigned int j = 0; (j < example.expressions.size()) && (j < NEXPRESSIONS); j++) {
+            ok &= parse_expression(example.expressions[j], expressions[j]);
+            any |= !expressions[j].empty();
+        }
+        if (!any || !ok) {
+            continue;
+        }
+        apply_config();
+        char name[32];
+        snprintf(name, sizeof(name), "eval_expr/example/%02u", i);
+        run(
+            name, []() {
+                host_time += 1000;
+                for (uint8_t j = 0; j < NEXPRESSIONS; j++) {
+                    if (!expressions[j].empty()) {
+                        sink = eval_expr(j, host_time, true);
+                    }
+                }
+            },
+            example.description);
+    }
+}
+
+static void bench_handle_received_report() {
+    synthetic_config(100);
+    for (auto const& device : devices) {
+        uint32_t n = 0;
+        run(std::string("do_handle_received_report/") + device.name, [&n, &device]() {
+            do_handle_received_report(device.reports[n++ & 1], device.report_len, device.interface);
+        });
+    }
+}
+
+static void bench_parse_descriptor() {
+    const uint16_t interface = 0x0F00;
+    for (auto const& device : devices) {
+        run(std::string("parse_descriptor/") + device.name, [&device, interface]() {
+            parse_descriptor(0x1234, 0x5678, device.descriptor, device.descriptor_len, interface, 0);
+            clear_descriptor_data(interface >> 8);
+        });
+    }
+    for (uint8_t i = 0; i < nquirk_descriptors; i++) {
+        const quirk_descriptor_t& quirk = quirk_descriptors[i];
+        char name[48];
+        snprintf(name, sizeof(name), "parse_descriptor/quirk/%04x:%04x", quirk.vendor_id, quirk.product_id);
+        run(name, [&quirk, interface]() {
+            parse_descriptor(quirk.vendor_id, quirk.product_id, quirk.descriptor, quirk.len, interface, 0);
+            clear_descriptor_data(interface >> 8);
+        });
+    }
+    apply_config();
+}
+
+static void bench_set_mapping_from_config() {
+    static const unsigned int sizes[] = { 10, 100, 500 };
+    for (unsigned int nmappings : sizes) {
+        synthetic_config(nmappings);
+        run("set_mapping_from_config/" + std::to_string(nmappings), []() {
+            set_mapping_from_config();
+        });
+    }
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string ret;
+    for (char c : s) {
+        if ((c == '"') || (c == '\\')) {
+            ret += '\\';
+            ret += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret += buf;
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+static void print_json() {
+    printf("[\n");
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const result_t& r = results[i];
+        printf("  { \"name\": \"%s\", ", json_escape(r.name).c_str());
+        if (!r.description.empty()) {
+            printf("\"description\": \"%s\", ", json_escape(r.description).c_str());
+        }
+        printf("\"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f }%s\n",
+            (unsigned long long) r.iterations, r.ns_per_op, r.allocs_per_op, r.bytes_per_op,
+            (i + 1 < results.size()) ? "," : "");
+    }
+    printf("]\n");
+}
+
+static void print_table() {
+    printf("%-48s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "bytes/op");
+    for (auto const& r : results) {
+        printf("%-48s %12.1f %12.2f %12.1f", r.name.c_str(), r.ns_per_op, r.allocs_per_op, r.bytes_per_op);
+        if (!r.description.empty()) {
+            printf("  %s", r.description.c_str());
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    const char* examples_filename = EXAMPLES_JS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "jf:t:e:")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = true;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                min_time_ns = strtoull(optarg, NULL, 0) * 1000000;
+                break;
+            case 'e':
+                examples_filename = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-f filter] [-t min_time_ms] [-e examples.js]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<example_t> examples;
+    if (!read_examples(examples_filename, examples)) {
+        return 1;
+    }
+
+    my_mutexes_init();
+    load_config(host_persisted_config);
+    our_descriptor = &our_descriptors[our_descriptor_number];
+    parse_our_descriptor();
+    connect_devices();
+
+    bench_bits();
+    bench_process_mapping();
+    bench_eval_expr_ops();
+    bench_eval_expr_examples(examples);
+    bench_handle_received_report();
+    bench_parse_descriptor();
+    bench_set_mapping_from_config();
+
+    if (json) {
+        print_json();
+    } else {
+        print_table();
+    }
+
+    return 0;
+}
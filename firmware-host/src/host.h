@@ -0,0 +1,23 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+
+enum class HostOutType : int8_t {
+    OUTPUT = 0,
+    SET_FEATURE = 1,
+    GET_FEATURE = 2,
+};
+
+typedef void (*host_out_report_t)(HostOutType type, uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len);
+
+// Whatever drives the engine owns the clock, get_time() just returns this.
+extern uint64_t host_time;
+
+// Plays the role of the config area in flash.
+extern uint8_t host_persisted_config[PERSISTED_CONFIG_SIZE];
+
+// Called for reports the engine wants sent to the devices, can be null.
+extern host_out_report_t host_out_report;
+
+#endif
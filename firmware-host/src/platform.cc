@@ -0,0 +1,78 @@
+#include <cstring>
+
+#include "host.h"
+#include "platform.h"
+#include "remapper.h"
+
+// Same pins as the "pico" board build, with UART on 12/13 and PIO-USB on 14/15.
+#define HOST_GPIO_VALID_PINS (0b00011100011111111111111111111111 & ~(0b1111 << 12))
+
+uint64_t host_time = 0;
+uint8_t host_persisted_config[PERSISTED_CONFIG_SIZE];
+host_out_report_t host_out_report = nullptr;
+
+void do_persist_config(uint8_t* buffer) {
+    memcpy(host_persisted_config, buffer, PERSISTED_CONFIG_SIZE);
+}
+
+void reset_to_bootloader() {
+}
+
+void pair_new_device() {
+}
+
+void clear_bonds() {
+}
+
+void flash_b_side() {
+}
+
+// Everything runs on one thread.
+void my_mutexes_init() {
+}
+
+void my_mutex_enter(MutexId id) {
+}
+
+void my_mutex_exit(MutexId id) {
+}
+
+uint64_t get_time() {
+    return host_time;
+}
+
+uint64_t get_unique_id() {
+    return 0x0123456789ABCDEF;
+}
+
+uint32_t get_gpio_valid_pins_mask() {
+    return HOST_GPIO_VALID_PINS;
+}
+
+void set_gpio_inout_masks(uint32_t in_mask, uint32_t out_mask) {
+}
+
+void interval_override_updated() {
+}
+
+void queue_out_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len) {
+    if (host_out_report != nullptr) {
+        host_out_report(HostOutType::OUTPUT, interface, report_id, buffer, len);
+    }
+}
+
+void queue_set_feature_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len) {
+    if (host_out_report != nullptr) {
+        host_out_report(HostOutType::SET_FEATURE, interface, report_id, buffer, len);
+    }
+}
+
+void queue_get_feature_report(uint16_t interface, uint8_t report_id, uint8_t len) {
+    if (host_out_report != nullptr) {
+        host_out_report(HostOutType::GET_FEATURE, interface, report_id, nullptr, len);
+    }
+}
+
+// Out reports are handed to host_out_report as soon as they're queued.
+void send_out_report() {
+}
@@ -0,0 +1,326 @@
+// Feeds a recorded stream of device events through the remapping engine and
+// prints what the host would have received, with timestamps.
+//
+// usage: replay [-c config.bin] [-p poll_interval_us] [-t tail_us] events.txt
+//
+// config.bin is the PERSISTED_CONFIG_SIZE bytes the firmware keeps in flash.
+// Without it the engine starts with the default configuration.
+//
+// Each line of events.txt is one of:
+//
+//   <time_us> descriptor <interface> <vid> <pid> <hub_port> <itf_num> <hex bytes>
+//   <time_us> report <interface> <hex bytes>
+//   <time_us> disconnect <interface>
+//
+// where interface is (dev_addr << 8) | instance, numbers can be decimal or
+// 0x-prefixed hex, and lines starting with # are ignored. Events must be in
+// time order.
+//
+// Output lines are:
+//
+//   <time_us> in <report id and report as hex bytes>
+//   <time_us> out <interface> <report id> <hex bytes>
+//   <time_us> set_feature <interface> <report id> <hex bytes>
+//   <time_us> get_feature <interface> <report id> <len>
+//
+// "in" reports are timestamped when the host polls them, the rest when the
+// engine queues them.
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "descriptor_parser.h"
+#include "globals.h"
+#include "host.h"
+#include "our_descriptor.h"
+#include "platform.h"
+#include "remapper.h"
+
+#define TICK_INTERVAL_US 1000
+
+enum class EventType : int8_t {
+    DESCRIPTOR = 0,
+    REPORT = 1,
+    DISCONNECT = 2,
+};
+
+struct event_t {
+    uint64_t time;
+    EventType type;
+    uint16_t interface;
+    uint16_t vid;
+    uint16_t pid;
+    uint8_t hub_port;
+    uint8_t itf_num;
+    std::vector<uint8_t> data;
+};
+
+static uint8_t in_flight[65];
+static uint8_t in_flight_len = 0;
+
+static void print_bytes(const uint8_t* buffer, uint8_t len) {
+    for (int i = 0; i < len; i++) {
+        printf(" %02x", buffer[i]);
+    }
+    printf("\n");
+}
+
+// Stands in for tud_hid_n_ready(0), a report stays in flight until the next poll.
+static bool endpoint_ready() {
+    return in_flight_len == 0;
+}
+
+static bool do_send_report(uint8_t interface, const uint8_t* report_with_id, uint8_t len) {
+    if (len > sizeof(in_flight)) {
+        return false;
+    }
+    memcpy(in_flight, report_with_id, len);
+    in_flight_len = len;
+    return true;
+}
+
+static void print_out_report(HostOutType type, uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len) {
+    switch (type) {
+        case HostOutType::OUTPUT:
+            printf("%llu out 0x%04x %d", (unsigned long long) host_time, interface, report_id);
+            print_bytes(buffer, len);
+            break;
+        case HostOutType::SET_FEATURE:
+            printf("%llu set_feature 0x%04x %d", (unsigned long long) host_time, interface, report_id);
+            print_bytes(buffer, len);
+            break;
+        case HostOutType::GET_FEATURE:
+            printf("%llu get_feature 0x%04x %d %d\n", (unsigned long long) host_time, interface, report_id, len);
+            break;
+    }
+}
+
+static bool parse_number(std::istringstream& ss, uint64_t* value) {
+    std::string token;
+    if (!(ss >> token)) {
+        return false;
+    }
+    char* end;
+    *value = strtoull(token.c_str(), &end, 0);
+    return *end == '\0';
+}
+
+static bool parse_bytes(std::istringstream& ss, std::vector<uint8_t>& data) {
+    std::string token;
+    while (ss >> token) {
+        char* end;
+        unsigned long value = strtoul(token.c_str(), &end, 16);
+        if ((*end != '\0') || (value > 0xFF)) {
+            return false;
+        }
+        data.push_back(value);
+    }
+    return true;
+}
+
+static bool parse_event(const std::string& line, event_t& event) {
+    std::istringstream ss(line);
+    uint64_t time;
+    std::string type;
+    uint64_t interface;
+    if (!parse_number(ss, &time) || !(ss >> type) || !parse_number(ss, &interface)) {
+        return false;
+    }
+    event.time = time;
+    event.interface = interface;
+    if (type == "descriptor") {
+        uint64_t vid, pid, hub_port, itf_num;
+        if (!parse_number(ss, &vid) || !parse_number(ss, &pid) || !parse_number(ss, &hub_port) || !parse_number(ss, &itf_num)) {
+            return false;
+        }
+        event.type = EventType::DESCRIPTOR;
+        event.vid = vid;
+        event.pid = pid;
+        event.hub_port = hub_port;
+        event.itf_num = itf_num;
+        return parse_bytes(ss, event.data) && !event.data.empty();
+    }
+    if (type == "report") {
+        event.type = EventType::REPORT;
+        return parse_bytes(ss, event.data) && !event.data.empty();
+    }
+    if (type == "disconnect") {
+        event.type = EventType::DISCONNECT;
+        return true;
+    }
+    return false;
+}
+
+static bool read_events(const char* filename, std::vector<event_t>& events) {
+    std::ifstream f(filename);
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", filename);
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(f, line)) {
+        line_no++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if ((start == std::string::npos) || (line[start] == '#')) {
+            continue;
+        }
+        event_t event;
+        if (!parse_event(line, event)) {
+            fprintf(stderr, "%s:%d: can't parse event\n", filename, line_no);
+            return false;
+        }
+        if (!events.empty() && (event.time < events.back().time)) {
+            fprintf(stderr, "%s:%d: event out of order\n", filename, line_no);
+            return false;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+static bool read_config(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", filename);
+        return false;
+    }
+    size_t len = fread(host_persisted_config, 1, PERSISTED_CONFIG_SIZE, f);
+    fclose(f);
+    if (len != PERSISTED_CONFIG_SIZE) {
+        fprintf(stderr, "%s: expected %d bytes, got %zu\n", filename, PERSISTED_CONFIG_SIZE, len);
+        return false;
+    }
+    return true;
+}
+
+static void handle_event(const event_t& event) {
+    switch (event.type) {
+        case EventType::DESCRIPTOR:
+            parse_descriptor(event.vid, event.pid, event.data.data(), event.data.size(), event.interface, event.itf_num);
+            device_connected_callback(event.interface, event.vid, event.pid, event.hub_port);
+            break;
+        case EventType::REPORT:
+            handle_received_report(event.data.data(), event.data.size(), event.interface);
+            break;
+        case EventType::DISCONNECT:
+            device_disconnected_callback(event.interface >> 8);
+            break;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* config_filename = NULL;
+    uint64_t poll_interval = 1000;
+    uint64_t tail = 1000000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:p:t:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_filename = optarg;
+                break;
+            case 'p':
+                poll_interval = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                tail = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c config.bin] [-p poll_interval_us] [-t tail_us] events.txt\n", argv[0]);
+                return 1;
+        }
+    }
+    if ((optind != argc - 1) || (poll_interval == 0)) {
+        fprintf(stderr, "usage: %s [-c config.bin] [-p poll_interval_us] [-t tail_us] events.txt\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<event_t> events;
+    if (!read_events(argv[optind], events)) {
+        return 1;
+    }
+    if ((config_filename != NULL) && !read_config(config_filename)) {
+        return 1;
+    }
+
+    host_out_report = print_out_report;
+    my_mutexes_init();
+    load_config(host_persisted_config);
+    our_descriptor = &our_descriptors[our_descriptor_number];
+    parse_our_descriptor();
+    set_mapping_from_config();
+
+    // Same order of things as the main loop in the firmware, with the
+    // processing tick and the host's polls on their own fixed schedules.
+    uint64_t end = (events.empty() ? 0 : events.back().time) + tail;
+    uint64_t next_tick = TICK_INTERVAL_US;
+    uint64_t next_poll = poll_interval;
+    size_t next_event = 0;
+
+    while (true) {
+        uint64_t now = (next_tick < next_poll) ? next_tick : next_poll;
+        if ((next_event < events.size()) && (events[next_event].time < now)) {
+            now = events[next_event].time;
+        }
+        if (now > end) {
+            break;
+        }
+        host_time = now;
+
+        if (now == next_poll) {
+            next_poll += poll_interval;
+            if (in_flight_len > 0) {
+                printf("%llu in", (unsigned long long) now);
+                print_bytes(in_flight, in_flight_len);
+                in_flight_len = 0;
+                report_delivered();
+            }
+        }
+
+        bool new_report = false;
+        while ((next_event < events.size()) && (events[next_event].time == now)) {
+            handle_event(events[next_event]);
+            new_report |= (events[next_event].type == EventType::REPORT);
+            next_event++;
+        }
+
+        if (their_descriptor_updated) {
+            update_their_descriptor_derivates();
+            their_descriptor_updated = false;
+        }
+        if (now == next_tick) {
+            next_tick += TICK_INTERVAL_US;
+            process_mapping(true);
+            if (endpoint_ready()) {
+                send_report(do_send_report);
+            }
+        } else if (new_report && immediate_processing) {
+            process_mapping(false);
+            if (endpoint_ready()) {
+                send_report(do_send_report);
+            }
+        }
+        if (boot_protocol_updated) {
+            parse_our_descriptor();
+            boot_protocol_updated = false;
+            config_updated = true;
+        }
+        if (config_updated) {
+            set_mapping_from_config();
+            config_updated = false;
+        }
+        if (endpoint_ready()) {
+            send_report(do_send_report);
+        }
+    }
+
+    return 0;
+}
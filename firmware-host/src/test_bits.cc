@@ -0,0 +1,172 @@
+// Checks the bitfield kernels in bits.h against the bit-at-a-time loops they
+// replaced, for every field position and size in reports of every length up
+// to MAX_LEN, including fields that run past the end of the report.
+
+#include <cstdio>
+#include <cstring>
+
+#include "bits.h"
+
+#define MAX_LEN 12
+#define GUARD 8
+#define MAX_SIZE 32
+
+static int8_t ref_get_bit(const uint8_t* data, int len, uint16_t bitpos) {
+    int byte_no = bitpos / 8;
+    int bit_no = bitpos % 8;
+    if (byte_no < len) {
+        return (data[byte_no] & 1 << bit_no) ? 1 : 0;
+    }
+    return 0;
+}
+
+static uint32_t ref_get_bits(const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint32_t) ref_get_bit(data, len, bitpos + i) << i;
+    }
+    return value;
+}
+
+static void ref_put_bit(uint8_t* data, int len, uint16_t bitpos, uint8_t value) {
+    int byte_no = bitpos / 8;
+    int bit_no = bitpos % 8;
+    if (byte_no < len) {
+        data[byte_no] &= ~(1 << bit_no);
+        data[byte_no] |= (value & 1) << bit_no;
+    }
+}
+
+static void ref_put_bits(uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
+    for (int i = 0; i < size; i++) {
+        ref_put_bit(data, len, bitpos + i, (value >> i) & 1);
+    }
+}
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void fill(uint8_t* data, int pattern) {
+    for (int i = 0; i < MAX_LEN + GUARD; i++) {
+        switch (pattern) {
+            case 0:
+                data[i] = 0x00;
+                break;
+            case 1:
+                data[i] = 0xFF;
+                break;
+            default:
+                data[i] = rng();
+                break;
+        }
+    }
+}
+
+static const int NPATTERNS = 6;
+
+static uint32_t test_value(int pattern, uint8_t size) {
+    switch (pattern) {
+        case 0:
+            return 0;
+        case 1:
+            return 0xFFFFFFFF;
+        case 2:
+            // bits above the field size must be ignored
+            return (size < 32) ? (1u << size) : 0x80000000;
+        default:
+            return rng();
+    }
+}
+
+static unsigned int failures = 0;
+
+static void fail(const char* what, int len, uint16_t bitpos, uint8_t size, uint32_t expected, uint32_t got) {
+    if (failures++ < 20) {
+        fprintf(stderr, "%s: len=%d bitpos=%d size=%d kernel=%d expected=0x%08x got=0x%08x\n",
+            what, len, bitpos, size, (int) bits_kernel(bitpos, size), expected, got);
+    }
+}
+
+int main() {
+    uint64_t checks = 0;
+    uint8_t data[MAX_LEN + GUARD];
+    uint8_t expected[MAX_LEN + GUARD];
+    uint8_t got[MAX_LEN + GUARD];
+
+    for (int len = 0; len <= MAX_LEN; len++) {
+        for (uint16_t bitpos = 0; bitpos < (MAX_LEN + 2) * 8; bitpos++) {
+            for (uint8_t size = 0; size <= MAX_SIZE; size++) {
+                BitsKernel kernel = bits_kernel(bitpos, size);
+                for (int pattern = 0; pattern < NPATTERNS; pattern++) {
+                    fill(data, pattern);
+
+                    uint32_t ref = ref_get_bits(data, len, bitpos, size);
+                    uint32_t plain = get_bits(data, len, bitpos, size);
+                    uint32_t kerneled = get_bits(kernel, data, len, bitpos, size);
+                    if (plain != ref) {
+                        fail("get_bits", len, bitpos, size, ref, plain);
+                    }
+                    if (kerneled != ref) {
+                        fail("get_bits(kernel)", len, bitpos, size, ref, kerneled);
+                    }
+
+                    uint32_t value = test_value(pattern, size);
+                    memcpy(expected, data, sizeof(data));
+                    ref_put_bits(expected, len, bitpos, size, value);
+
+                    memcpy(got, data, sizeof(data));
+                    put_bits(got, len, bitpos, size, value);
+                    for (int i = 0; i < MAX_LEN + GUARD; i++) {
+                        if (got[i] != expected[i]) {
+                            fail("put_bits", len, bitpos, size, expected[i], got[i]);
+                            break;
+                        }
+                    }
+
+                    memcpy(got, data, sizeof(data));
+                    put_bits(kernel, got, len, bitpos, size, value);
+                    for (int i = 0; i < MAX_LEN + GUARD; i++) {
+                        if (got[i] != expected[i]) {
+                            fail("put_bits(kernel)", len, bitpos, size, expected[i], got[i]);
+                            break;
+                        }
+                    }
+
+                    checks += 4;
+                }
+            }
+        }
+    }
+
+    // array fields use the kernel picked for their first element
+    static const uint8_t array_sizes[] = { 1, 8, 16, 32 };
+    for (int len = 0; len <= MAX_LEN; len++) {
+        for (uint8_t size : array_sizes) {
+            for (uint16_t first = 0; first < 16; first += 8) {
+                BitsKernel kernel = bits_kernel(first, size);
+                for (uint16_t bitpos = first; bitpos < (MAX_LEN + 2) * 8; bitpos += size) {
+                    fill(data, 2);
+                    uint32_t ref = ref_get_bits(data, len, bitpos, size);
+                    uint32_t kerneled = get_bits(kernel, data, len, bitpos, size);
+                    if (kerneled != ref) {
+                        fail("get_bits(array kernel)", len, bitpos, size, ref, kerneled);
+                    }
+                    checks++;
+                }
+            }
+        }
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%u of %llu checks failed\n", failures, (unsigned long long) checks);
+        return 1;
+    }
+    printf("%llu checks passed\n", (unsigned long long) checks);
+    return 0;
+}
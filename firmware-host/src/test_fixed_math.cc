@@ -0,0 +1,194 @@
+// Sweeps the integer math in fixed_math.h against libm, computed the same way
+// the expression engine does it when FIXED_POINT_MATH is off, and checks that
+// the results stay within the error bound.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "fixed_math.h"
+
+// in units of the *1000 scaled values
+#define MAX_ERROR 1
+
+static uint32_t rng_state = 0x9E3779B9;
+
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static unsigned int failures = 0;
+
+struct error_t {
+    const char* name;
+    uint64_t checks = 0;
+    int64_t max_error = 0;
+    int64_t worst_input[2] = { 0, 0 };
+};
+
+static void check(error_t& error, int64_t expected, int64_t got, int64_t limit, int64_t input0, int64_t input1 = 0) {
+    error.checks++;
+    int64_t diff = llabs(got - expected);
+    if (diff > error.max_error) {
+        error.max_error = diff;
+        error.worst_input[0] = input0;
+        error.worst_input[1] = input1;
+    }
+    if ((diff > limit) && (failures++ < 20)) {
+        fprintf(stderr, "%s(%lld, %lld): expected %lld, got %lld\n",
+            error.name, (long long) input0, (long long) input1, (long long) expected, (long long) got);
+    }
+}
+
+static void report(const error_t& error) {
+    printf("%-16s %10llu checks, max error %lld at (%lld, %lld)\n", error.name, (unsigned long long) error.checks,
+        (long long) error.max_error, (long long) error.worst_input[0], (long long) error.worst_input[1]);
+}
+
+static int32_t libm_sin(int32_t angle) {
+    return sinf((float) angle * 3.14159265f / 180000.0f) * 1000;
+}
+
+static int32_t libm_cos(int32_t angle) {
+    return cosf((float) angle * 3.14159265f / 180000.0f) * 1000;
+}
+
+static int32_t libm_atan2(int32_t y, int32_t x) {
+    return atan2(y, x) * 57295.779513;
+}
+
+static int32_t libm_sqrt(int32_t value) {
+    return sqrt(value) * 31.622776601683793;
+}
+
+// atan2 results on either side of the +-180 degree cut are the same angle
+static int32_t atan2_distance(int32_t a, int32_t b) {
+    int32_t diff = abs(a - b);
+    return (diff > 180000) ? 360000 - diff : diff;
+}
+
+static void test_sin_cos() {
+    error_t sin_error{ "fixed_sin" };
+    error_t cos_error{ "fixed_cos" };
+    // float still represents every angle exactly in this range
+    for (int32_t angle = -1080000; angle <= 1080000; angle++) {
+        check(sin_error, libm_sin(angle), fixed_sin(angle), MAX_ERROR, angle);
+        check(cos_error, libm_cos(angle), fixed_cos(angle), MAX_ERROR, angle);
+    }
+    report(sin_error);
+    report(cos_error);
+}
+
+static void test_atan2() {
+    error_t error{ "fixed_atan2" };
+    for (int32_t y = -3000; y <= 3000; y += 3) {
+        for (int32_t x = -3000; x <= 3000; x += 3) {
+            check(error, 0, atan2_distance(libm_atan2(y, x), fixed_atan2(y, x)), MAX_ERROR, y, x);
+        }
+    }
+    // stick-sized values and the edges of the int32 range
+    for (int i = 0; i < 2000000; i++) {
+        int32_t y = rng();
+        int32_t x = rng();
+        if (i & 1) {
+            y >>= 12;
+            x >>= 12;
+        }
+        check(error, 0, atan2_distance(libm_atan2(y, x), fixed_atan2(y, x)), MAX_ERROR, y, x);
+    }
+    static const int32_t edges[] = { INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX };
+    for (int32_t y : edges) {
+        for (int32_t x : edges) {
+            check(error, 0, atan2_distance(libm_atan2(y, x), fixed_atan2(y, x)), MAX_ERROR, y, x);
+        }
+    }
+    report(error);
+}
+
+static void test_sqrt() {
+    error_t error{ "fixed_sqrt" };
+    for (int32_t value = 0; value <= 4000000; value++) {
+        check(error, libm_sqrt(value), fixed_sqrt(value), MAX_ERROR, value);
+    }
+    for (int i = 0; i < 2000000; i++) {
+        int32_t value = rng() & 0x7FFFFFFF;
+        check(error, libm_sqrt(value), fixed_sqrt(value), MAX_ERROR, value);
+    }
+    check(error, libm_sqrt(INT32_MAX), fixed_sqrt(INT32_MAX), MAX_ERROR, INT32_MAX);
+    report(error);
+
+    // the deadzone radius must be exact
+    error_t isqrt_error{ "isqrt32" };
+    for (uint32_t n = 0; n <= 2 * 128 * 128 + 1000000; n++) {
+        check(isqrt_error, (int64_t) sqrt((double) n), isqrt32(n), 0, n);
+    }
+    for (int i = 0; i < 2000000; i++) {
+        uint32_t n = rng();
+        check(isqrt_error, (int64_t) sqrt((double) n), isqrt32(n), 0, n);
+    }
+    report(isqrt_error);
+
+    error_t isqrt64_error{ "isqrt64" };
+    for (int i = 0; i < 2000000; i++) {
+        uint64_t n = ((uint64_t) rng() << 32 | rng()) >> (rng() % 24);
+        uint64_t root = isqrt64(n);
+        // floor(sqrt(n)) without trusting double for large n
+        bool ok = (root * root <= n) && ((root + 1) * (root + 1) > n);
+        check(isqrt64_error, 0, ok ? 0 : 1, 0, n >> 32, n & 0xFFFFFFFF);
+    }
+    report(isqrt64_error);
+}
+
+static void check_fp32(error_t& error, uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    int64_t expected;
+    if (std::isnan(f)) {
+        expected = 0;
+    } else {
+        // exact product, truncated and saturated; the engine's float multiply
+        // is less precise than this above about 2^21
+        double product = std::trunc((double) f * 1000.0);
+        expected = (product >= 2147483647.0) ? INT32_MAX : (product <= -2147483648.0) ? INT32_MIN : (int64_t) product;
+        // denormals come out as 0, they're far below what the *1000 values can show
+        if (std::fpclassify(f) == FP_SUBNORMAL) {
+            expected = 0;
+        }
+    }
+    check(error, expected, fixed_from_fp32(bits), 0, bits);
+}
+
+static void test_fp32() {
+    error_t error{ "fixed_from_fp32" };
+    for (int32_t value = -2000000; value <= 2000000; value++) {
+        float f = value / 1000.0f;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        check_fp32(error, bits);
+    }
+    // every exponent, both signs, random mantissas
+    for (uint32_t exponent = 0; exponent <= 0xFF; exponent++) {
+        for (int i = 0; i < 20000; i++) {
+            uint32_t bits = (rng() & 0x807FFFFF) | (exponent << 23);
+            check_fp32(error, bits);
+        }
+    }
+    report(error);
+}
+
+int main() {
+    test_sin_cos();
+    test_atan2();
+    test_sqrt();
+    test_fp32();
+
+    if (failures > 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Runs key presses through the engine while the host isn't polling, so that
+// the outgoing queue fills up, and checks that no press gets lost. Once with
+// a keyboard whose reports go through the mapping and once with a device
+// that describes its reports exactly like we do, whose reports are passed
+// through. Also checks that a key held on that device stays held when a
+// config change stops the passthrough.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "config.h"
+#include "descriptor_parser.h"
+#include "globals.h"
+#include "host.h"
+#include "our_descriptor.h"
+#include "platform.h"
+#include "remapper.h"
+
+#define KEYBOARD_INTERFACE 0x0100
+#define PASSTHROUGH_INTERFACE 0x0200
+
+static const uint8_t keyboard_descriptor[] = { 0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0 };
+
+typedef std::vector<uint8_t> report_t;
+
+static std::vector<report_t> sent_reports;
+
+static bool collect_report(uint8_t interface, const uint8_t* report_with_id, uint8_t len) {
+    sent_reports.push_back(report_t(report_with_id, report_with_id + len));
+    return true;
+}
+
+static unsigned int failures = 0;
+
+static void fail(const char* what) {
+    failures++;
+    fprintf(stderr, "%s\n", what);
+}
+
+static void apply_config() {
+    set_mapping_from_config();
+    if (their_descriptor_updated) {
+        update_their_descriptor_derivates();
+        their_descriptor_updated = false;
+    }
+}
+
+static bool passthrough_device = false;
+
+// A key with no mapping of its own, so it goes out as it came in.
+static void press(uint8_t key) {
+    if (passthrough_device) {
+        // our keyboard report: ID 2, modifiers, then a bit for each key from 0x04
+        uint8_t report[17] = { 0x02 };
+        if (key != 0x00) {
+            report[2 + (key - 0x04) / 8] |= 1 << ((key - 0x04) % 8);
+        }
+        handle_received_report(report, sizeof(report), PASSTHROUGH_INTERFACE);
+    } else {
+        uint8_t report[8] = { 0x00, 0x00, key, 0x00, 0x00, 0x00, 0x00, 0x00 };
+        handle_received_report(report, sizeof(report), KEYBOARD_INTERFACE);
+    }
+}
+
+static void frame() {
+    host_time += 1000;
+    process_mapping(true);
+}
+
+static void drain() {
+    for (int i = 0; i < 100; i++) {
+        frame();
+        while (send_report(collect_report)) {
+        }
+    }
+}
+
+// What the host gets when the key is pressed on its own.
+static report_t pressed_report(uint8_t key) {
+    sent_reports.clear();
+    press(key);
+    drain();
+    press(0x00);
+    drain();
+    if (sent_reports.size() != 2) {
+        fail("pressing and releasing a key didn't produce two reports");
+        return report_t();
+    }
+    return sent_reports[0];
+}
+
+static bool was_sent(const report_t& report) {
+    for (auto const& sent : sent_reports) {
+        if (sent == report) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fills the queue with states that all carry an edge, then presses and
+// releases another key in consecutive frames before the host polls again.
+static void test_press_release_when_full() {
+    const uint8_t key_a = 0x06;
+    const uint8_t key_b = 0x07;
+    const report_t b_pressed = pressed_report(key_b);
+
+    sent_reports.clear();
+    for (int i = 0; i < outgoing_queue_depth; i++) {
+        press((i & 1) ? 0x00 : key_a);
+        frame();
+    }
+    press(key_b);
+    frame();
+    press(0x00);
+    frame();
+    drain();
+
+    if (!was_sent(b_pressed)) {
+        fail("key press lost while the queue was full");
+    }
+    if (sent_reports.empty() || (sent_reports.back() == b_pressed)) {
+        fail("key release lost while the queue was full");
+    }
+}
+
+// A key held while the device's reports are passed through must still be
+// held after a config change stops that.
+static void test_held_across_passthrough_off() {
+    const uint8_t key_b = 0x07;
+    const report_t b_pressed = pressed_report(key_b);
+
+    press(key_b);
+    drain();
+    sent_reports.clear();
+    config_mappings.push_back((mapping_config11_t){
+        .target_usage = 0x00070005,
+        .source_usage = 0x00070004,
+        .scaling = 1000,
+        .layer_mask = 1,
+    });
+    apply_config();
+    drain();
+    for (auto const& sent : sent_reports) {
+        if (sent != b_pressed) {
+            fail("held key released when passthrough was turned off");
+            break;
+        }
+    }
+
+    press(0x00);
+    drain();
+    if (sent_reports.empty() || (sent_reports.back() == b_pressed)) {
+        fail("key release lost after passthrough was turned off");
+    }
+    config_mappings.clear();
+    apply_config();
+}
+
+int main() {
+    my_mutexes_init();
+    load_config(host_persisted_config);
+    our_descriptor = &our_descriptors[our_descriptor_number];
+    parse_our_descriptor();
+    parse_descriptor(0x1234, 0x5678, keyboard_descriptor, sizeof(keyboard_descriptor), KEYBOARD_INTERFACE, 0);
+    device_connected_callback(KEYBOARD_INTERFACE, 0x1234, 0x5678, 1);
+
+    // a mapping for some other key keeps the reports going through the mapping
+    config_mappings.clear();
+    config_mappings.push_back((mapping_config11_t){
+        .target_usage = 0x00070005,
+        .source_usage = 0x00070004,
+        .scaling = 1000,
+        .layer_mask = 1,
+    });
+    unmapped_passthrough_layer_mask = 1;
+    apply_config();
+
+    outgoing_queue_keep_latest = false;
+    for (uint8_t depth = 1; depth <= OUTGOING_QUEUE_DEPTH; depth++) {
+        outgoing_queue_depth = depth;
+        test_press_release_when_full();
+    }
+
+    // the keyboard goes away, the other device is the only one left
+    device_disconnected_callback(KEYBOARD_INTERFACE >> 8);
+    parse_descriptor(0x1234, 0x5678, our_descriptor->descriptor, our_descriptor->descriptor_length, PASSTHROUGH_INTERFACE, 0);
+    device_connected_callback(PASSTHROUGH_INTERFACE, 0x1234, 0x5678, 2);
+    config_mappings.clear();
+    apply_config();
+    passthrough_device = true;
+
+    for (uint8_t depth = 1; depth <= OUTGOING_QUEUE_DEPTH; depth++) {
+        outgoing_queue_depth = depth;
+        test_press_release_when_full();
+    }
+    test_held_across_passthrough_off();
+
+    if (failures > 0) {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#ifndef _BITS_H_
+#define _BITS_H_
+
+#include <stdint.h>
+
+// Bitfield access for HID reports. Fields are little-endian, bitpos counts
+// from the least significant bit of the first byte. Bytes at or past len
+// read as zero and writes to them are dropped.
+
+enum class BitsKernel : uint8_t {
+    GENERIC = 0,
+    BIT = 1,
+    UINT8 = 2,
+    UINT16 = 3,
+    UINT32 = 4,
+};
+
+inline BitsKernel bits_kernel(uint16_t bitpos, uint8_t size) {
+    if (size == 1) {
+        return BitsKernel::BIT;
+    }
+    if (bitpos % 8 == 0) {
+        switch (size) {
+            case 8:
+                return BitsKernel::UINT8;
+            case 16:
+                return BitsKernel::UINT16;
+            case 32:
+                return BitsKernel::UINT32;
+        }
+    }
+    return BitsKernel::GENERIC;
+}
+
+inline int8_t get_bit(const uint8_t* data, int len, uint16_t bitpos) {
+    int byte_no = bitpos / 8;
+    int bit_no = bitpos % 8;
+    if (byte_no < len) {
+        return (data[byte_no] & 1 << bit_no) ? 1 : 0;
+    }
+    return 0;
+}
+
+inline void put_bit(uint8_t* data, int len, uint16_t bitpos, uint8_t value) {
+    int byte_no = bitpos / 8;
+    int bit_no = bitpos % 8;
+    if (byte_no < len) {
+        data[byte_no] &= ~(1 << bit_no);
+        data[byte_no] |= (value & 1) << bit_no;
+    }
+}
+
+// One bit at a time, used for fields that don't fit in the report.
+inline uint32_t get_bits_slow(const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= get_bit(data, len, bitpos + i) << i;
+    }
+    return value;
+}
+
+inline void put_bits_slow(uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
+    for (int i = 0; i < size; i++) {
+        put_bit(data, len, bitpos + i, (value >> i) & 1);
+    }
+}
+
+inline uint32_t get_bits(const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
+    int first = bitpos / 8;
+    int last = (bitpos + size - 1) / 8;
+    if ((size == 0) || (size > 32) || (last >= len)) {
+        return get_bits_slow(data, len, bitpos, size);
+    }
+    // a 32-bit field can span 5 bytes; M0+ can't do unaligned loads anyway
+    uint64_t word = 0;
+    for (int i = last; i >= first; i--) {
+        word = (word << 8) | data[i];
+    }
+    uint32_t mask = (size == 32) ? 0xFFFFFFFF : ((1u << size) - 1);
+    return (uint32_t) (word >> (bitpos % 8)) & mask;
+}
+
+inline void put_bits(uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
+    int first = bitpos / 8;
+    int last = (bitpos + size - 1) / 8;
+    if ((size == 0) || (size > 32) || (last >= len)) {
+        put_bits_slow(data, len, bitpos, size, value);
+        return;
+    }
+    uint32_t mask = (size == 32) ? 0xFFFFFFFF : ((1u << size) - 1);
+    uint64_t word_mask = (uint64_t) mask << (bitpos % 8);
+    uint64_t word = (uint64_t) (value & mask) << (bitpos % 8);
+    for (int i = first; i <= last; i++) {
+        data[i] = (data[i] & ~(uint8_t) word_mask) | (uint8_t) word;
+        word_mask >>= 8;
+        word >>= 8;
+    }
+}
+
+// The kernel must come from bits_kernel() for the same bitpos and size
+// (or for the first element of an array of such fields).
+inline uint32_t get_bits(BitsKernel kernel, const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
+    int byte_no = bitpos / 8;
+    switch (kernel) {
+        case BitsKernel::BIT:
+            return (byte_no < len) ? ((data[byte_no] >> (bitpos % 8)) & 1) : 0;
+        case BitsKernel::UINT8:
+            return (byte_no < len) ? data[byte_no] : 0;
+        case BitsKernel::UINT16:
+            if (byte_no + 1 < len) {
+                return data[byte_no] | (data[byte_no + 1] << 8);
+            }
+            break;
+        case BitsKernel::UINT32:
+            if (byte_no + 3 < len) {
+                return data[byte_no] | (data[byte_no + 1] << 8) | (data[byte_no + 2] << 16) | ((uint32_t) data[byte_no + 3] << 24);
+            }
+            break;
+        default:
+            break;
+    }
+    return get_bits(data, len, bitpos, size);
+}
+
+inline void put_bits(BitsKernel kernel, uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
+    int byte_no = bitpos / 8;
+    switch (kernel) {
+        case BitsKernel::BIT:
+            if (byte_no < len) {
+                data[byte_no] = (data[byte_no] & ~(1 << (bitpos % 8))) | ((value & 1) << (bitpos % 8));
+            }
+            return;
+        case BitsKernel::UINT8:
+            if (byte_no < len) {
+                data[byte_no] = value;
+            }
+            return;
+        case BitsKernel::UINT16:
+            if (byte_no + 1 < len) {
+                data[byte_no] = value;
+                data[byte_no + 1] = value >> 8;
+                return;
+            }
+            break;
+        case BitsKernel::UINT32:
+            if (byte_no + 3 < len) {
+                data[byte_no] = value;
+                data[byte_no + 1] = value >> 8;
+                data[byte_no + 2] = value >> 16;
+                data[byte_no + 3] = value >> 24;
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    put_bits(data, len, bitpos, size, value);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include <tusb.h>
+#include <cstdio>
+#include <cstring>
+
+#include "clone_device.h"
+#include "globals.h"
+#include "interval_override.h"
+
+// 真正的设备克隆：从原始设备获取完整信息
+void read_device_identity(uint8_t dev_addr, uint16_t vid, uint16_t pid, cloned_device_info_t& info) {
+    printf("Starting device cloning: VID=0x%04X, PID=0x%04X\n", vid, pid);
+
+    // 保存基本设备信息
+    info = cloned_device_info_t();
+    info.vid = vid;
+    info.pid = pid;
+    info.is_cloned = true;
+
+    // 获取真实的设备描述符
+    tusb_desc_device_t device_desc;
+    if (tuh_descriptor_get_device_sync(dev_addr, &device_desc, sizeof(device_desc)) == XFER_RESULT_SUCCESS) {
+        info.bcd_device = device_desc.bcdDevice;
+        printf("Cloned device version: 0x%04X\n", info.bcd_device);
+
+        // 获取真实的厂商字符串
+        uint8_t str_buffer[128];
+        if (tuh_descriptor_get_manufacturer_string_sync(dev_addr, 0x0409, str_buffer, sizeof(str_buffer)) == XFER_RESULT_SUCCESS) {
+            // 转换UTF-16到ASCII
+            uint8_t len = str_buffer[0];
+            for (int i = 0; i < (len - 2) / 2 && i < 63; i++) {
+                info.manufacturer[i] = str_buffer[2 + i * 2];
+            }
+            info.manufacturer[63] = '\0';
+            printf("Cloned manufacturer: %s\n", info.manufacturer);
+        } else {
+            strcpy(info.manufacturer, "Unknown");
+        }
+
+        // 获取真实的产品字符串
+        if (tuh_descriptor_get_product_string_sync(dev_addr, 0x0409, str_buffer, sizeof(str_buffer)) == XFER_RESULT_SUCCESS) {
+            // 转换UTF-16到ASCII
+            uint8_t len = str_buffer[0];
+            for (int i = 0; i < (len - 2) / 2 && i < 63; i++) {
+                info.product[i] = str_buffer[2 + i * 2];
+            }
+            info.product[63] = '\0';
+            printf("Cloned product: %s\n", info.product);
+        } else {
+            strcpy(info.product, "HID Device");
+        }
+
+        // 获取真实的序列号字符串
+        if (tuh_descriptor_get_serial_string_sync(dev_addr, 0x0409, str_buffer, sizeof(str_buffer)) == XFER_RESULT_SUCCESS) {
+            // 转换UTF-16到ASCII
+            uint8_t len = str_buffer[0];
+            for (int i = 0; i < (len - 2) / 2 && i < 63; i++) {
+                info.serial_number[i] = str_buffer[2 + i * 2];
+            }
+            info.serial_number[63] = '\0';
+            printf("Cloned serial: %s\n", info.serial_number);
+        } else {
+            strcpy(info.serial_number, "000000000001");
+        }
+
+    } else {
+        printf("Failed to get device descriptor, using fallback values\n");
+        info.bcd_device = 0x0100;
+        strcpy(info.manufacturer, "Generic");
+        strcpy(info.product, "HID Device");
+        strcpy(info.serial_number, "000000000001");
+    }
+}
+
+void apply_device_identity(const cloned_device_info_t& info, uint8_t interval) {
+    cloned_device = info;
+    interval_override = interval;
+    printf("Device cloning completed: %s %s (interval %d)\n",
+           cloned_device.manufacturer, cloned_device.product, interval);
+}
+
+void clone_device_identity(uint8_t dev_addr, uint16_t vid, uint16_t pid) {
+    cloned_device_info_t info;
+    read_device_identity(dev_addr, vid, pid, info);
+    apply_device_identity(info, CLONED_DEVICE_INTERVAL);
+}
@@ -0,0 +1,17 @@
+#ifndef _CLONE_DEVICE_H_
+#define _CLONE_DEVICE_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+// 强制设置1000Hz轮询率 (1ms间隔)
+#define CLONED_DEVICE_INTERVAL 1
+
+// Asks the device for its descriptors, so it has to run where the host stack does.
+void read_device_identity(uint8_t dev_addr, uint16_t vid, uint16_t pid, cloned_device_info_t& info);
+// Makes us present ourselves as that device, on the core that runs the device stack.
+void apply_device_identity(const cloned_device_info_t& info, uint8_t interval);
+void clone_device_identity(uint8_t dev_addr, uint16_t vid, uint16_t pid);
+
+#endif
@@ -8,9 +8,10 @@
 #include "interval_override.h"
 #include "our_descriptor.h"
 #include "platform.h"
+#include "profiler.h"
 #include "remapper.h"
 
-const uint8_t CONFIG_VERSION = 18;
+const uint8_t CONFIG_VERSION = 19;
 
 const uint8_t CONFIG_FLAG_UNMAPPED_PASSTHROUGH = 0x01;
 const uint8_t CONFIG_FLAG_UNMAPPED_PASSTHROUGH_MASK = 0b00001111;
@@ -18,6 +19,7 @@ const uint8_t CONFIG_FLAG_UNMAPPED_PASSTHROUGH_BIT = 0;
 const uint8_t CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT = 4;
 const uint8_t CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT = 5;
 const uint8_t CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT = 6;
+const uint8_t CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT = 7;
 
 ConfigCommand last_config_command = ConfigCommand::NO_COMMAND;
 uint32_t requested_index = 0;
@@ -549,6 +551,76 @@ void load_config_v13(const uint8_t* persisted_config) {
     my_mutex_exit(MutexId::QUIRKS);
 }
 
+void load_config_v18(const uint8_t* persisted_config) {
+    persist_config_v18_t* config = (persist_config_v18_t*) persisted_config;
+    unmapped_passthrough_layer_mask = config->unmapped_passthrough_layer_mask;
+    ignore_auth_dev_inputs = config->flags & (1 << CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT);
+    gpio_output_mode = !!(config->flags & (1 << CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT));
+    normalize_gamepad_inputs = !!(config->flags & (1 << CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT));
+    immediate_processing = !!(config->flags & (1 << CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT));
+    partial_scroll_timeout = config->partial_scroll_timeout;
+    tap_hold_threshold = config->tap_hold_threshold;
+    gpio_debounce_time = config->gpio_debounce_time_ms * 1000;
+    interval_override = config->interval_override;
+    our_descriptor_number = config->our_descriptor_number;
+    if (our_descriptor_number >= NOUR_DESCRIPTORS) {
+        our_descriptor_number = 0;
+    }
+    macro_entry_duration = config->macro_entry_duration;
+    mapping_config11_t* buffer_mappings = (mapping_config11_t*) (persisted_config + sizeof(persist_config_v18_t));
+    for (uint32_t i = 0; i < config->mapping_count; i++) {
+        config_mappings.push_back(buffer_mappings[i]);
+    }
+
+    const uint8_t* macros_config_ptr = (persisted_config + sizeof(persist_config_v18_t) + config->mapping_count * sizeof(mapping_config11_t));
+    my_mutex_enter(MutexId::MACROS);
+    for (int i = 0; i < NMACROS; i++) {
+        macros[i].clear();
+        uint8_t macro_len = *macros_config_ptr;
+        macros_config_ptr++;
+        macros[i].reserve(macro_len);
+        for (int j = 0; j < macro_len; j++) {
+            uint8_t entry_len = *macros_config_ptr;
+            macros_config_ptr++;
+            macros[i].push_back({});
+            macros[i].back().reserve(entry_len);
+            for (int k = 0; k < entry_len; k++) {
+                macros[i].back().push_back(((macro_item_t*) macros_config_ptr)->usage);
+                macros_config_ptr += sizeof(macro_item_t);
+            }
+        }
+    }
+    my_mutex_exit(MutexId::MACROS);
+
+    const uint8_t* expr_config_ptr = macros_config_ptr;
+    my_mutex_enter(MutexId::EXPRESSIONS);
+    for (int i = 0; i < NEXPRESSIONS; i++) {
+        expressions[i].clear();
+        uint16_t expr_len = ((uint16_val_t*) expr_config_ptr)->val;
+        expr_config_ptr += 2;
+        expressions[i].reserve(expr_len);
+        for (int j = 0; j < expr_len; j++) {
+            uint8_t op = *expr_config_ptr;
+            expr_config_ptr++;
+            uint32_t val = 0;
+            if ((op == (uint8_t) Op::PUSH) || (op == (uint8_t) Op::PUSH_USAGE)) {
+                val = ((expr_val_t*) expr_config_ptr)->val;
+                expr_config_ptr += sizeof(expr_val_t);
+            }
+            expressions[i].push_back((expr_elem_t){ .op = (Op) op, .val = val });
+        }
+    }
+    my_mutex_exit(MutexId::EXPRESSIONS);
+
+    my_mutex_enter(MutexId::QUIRKS);
+    quirk_t* quirk_config_ptr = (quirk_t*) expr_config_ptr;
+    for (int i = 0; i < config->quirk_count; i++) {
+        quirks.push_back(*quirk_config_ptr);
+        quirk_config_ptr++;
+    }
+    my_mutex_exit(MutexId::QUIRKS);
+}
+
 void load_config(const uint8_t* persisted_config) {
     if (!checksum_ok(persisted_config, PERSISTED_CONFIG_SIZE) || !persisted_version_ok(persisted_config)) {
         return;
@@ -616,11 +688,17 @@ void load_config(const uint8_t* persisted_config) {
         return;
     }
 
-    persist_config_v18_t* config = (persist_config_v18_t*) persisted_config;
+    if (version == 18) {
+        load_config_v18(persisted_config);
+        return;
+    }
+
+    persist_config_v19_t* config = (persist_config_v19_t*) persisted_config;
     unmapped_passthrough_layer_mask = config->unmapped_passthrough_layer_mask;
     ignore_auth_dev_inputs = config->flags & (1 << CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT);
     gpio_output_mode = !!(config->flags & (1 << CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT));
     normalize_gamepad_inputs = !!(config->flags & (1 << CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT));
+    immediate_processing = !!(config->flags & (1 << CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT));
     partial_scroll_timeout = config->partial_scroll_timeout;
     tap_hold_threshold = config->tap_hold_threshold;
     gpio_debounce_time = config->gpio_debounce_time_ms * 1000;
@@ -630,12 +708,13 @@ void load_config(const uint8_t* persisted_config) {
         our_descriptor_number = 0;
     }
     macro_entry_duration = config->macro_entry_duration;
-    mapping_config11_t* buffer_mappings = (mapping_config11_t*) (persisted_config + sizeof(persist_config_v18_t));
+    tick_margin = config->tick_margin;
+    mapping_config11_t* buffer_mappings = (mapping_config11_t*) (persisted_config + sizeof(persist_config_v19_t));
     for (uint32_t i = 0; i < config->mapping_count; i++) {
         config_mappings.push_back(buffer_mappings[i]);
     }
 
-    const uint8_t* macros_config_ptr = (persisted_config + sizeof(persist_config_v18_t) + config->mapping_count * sizeof(mapping_config11_t));
+    const uint8_t* macros_config_ptr = (persisted_config + sizeof(persist_config_v19_t) + config->mapping_count * sizeof(mapping_config11_t));
     my_mutex_enter(MutexId::MACROS);
     for (int i = 0; i < NMACROS; i++) {
         macros[i].clear();
@@ -690,6 +769,7 @@ void fill_get_config(get_config_t* config) {
     config->flags |= ignore_auth_dev_inputs << CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT;
     config->flags |= gpio_output_mode << CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT;
     config->flags |= normalize_gamepad_inputs << CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT;
+    config->flags |= immediate_processing << CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT;
     config->unmapped_passthrough_layer_mask = unmapped_passthrough_layer_mask;
     config->partial_scroll_timeout = partial_scroll_timeout;
     config->tap_hold_threshold = tap_hold_threshold;
@@ -700,6 +780,7 @@ void fill_get_config(get_config_t* config) {
     config->interval_override = interval_override;
     config->our_descriptor_number = our_descriptor_number;
     config->macro_entry_duration = macro_entry_duration;
+    config->tick_margin = tick_margin;
     my_mutex_enter(MutexId::QUIRKS);
     config->quirk_count = quirks.size();
     my_mutex_exit(MutexId::QUIRKS);
@@ -711,6 +792,7 @@ void fill_persist_config(persist_config_t* config) {
     config->flags |= ignore_auth_dev_inputs << CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT;
     config->flags |= gpio_output_mode << CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT;
     config->flags |= normalize_gamepad_inputs << CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT;
+    config->flags |= immediate_processing << CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT;
     config->unmapped_passthrough_layer_mask = unmapped_passthrough_layer_mask;
     config->partial_scroll_timeout = partial_scroll_timeout;
     config->tap_hold_threshold = tap_hold_threshold;
@@ -719,6 +801,7 @@ void fill_persist_config(persist_config_t* config) {
     config->interval_override = interval_override;
     config->our_descriptor_number = our_descriptor_number;
     config->macro_entry_duration = macro_entry_duration;
+    config->tick_margin = tick_margin;
     my_mutex_enter(MutexId::QUIRKS);
     config->quirk_count = quirks.size();
     my_mutex_exit(MutexId::QUIRKS);
@@ -934,6 +1017,62 @@ uint16_t handle_get_report1(uint8_t report_id, uint8_t* buffer, uint16_t reqlen)
                 my_mutex_exit(MutexId::QUIRKS);
                 break;
             }
+            case ConfigCommand::GET_LATENCY_SAVED: {
+                latency_saved_t* returned = (latency_saved_t*) config_buffer;
+                returned->immediate_runs = immediate_runs;
+                returned->latency_saved_us = latency_saved;
+                break;
+            }
+            case ConfigCommand::GET_OUTPUT_QUEUE_STATS: {
+                output_queue_stats_t* returned = (output_queue_stats_t*) config_buffer;
+                returned->reports_merged = reports_merged;
+                returned->reports_dropped = reports_dropped;
+                break;
+            }
+            case ConfigCommand::GET_OUTPUT_QUEUE_CONFIG: {
+                output_queue_config_t* returned = (output_queue_config_t*) config_buffer;
+                returned->depth = outgoing_queue_depth;
+                returned->keep_latest = outgoing_queue_keep_latest;
+                returned->max_depth = OUTGOING_QUEUE_DEPTH;
+                break;
+            }
+            case ConfigCommand::GET_EXPRESSION_STATS: {
+                expression_stats_t* returned = (expression_stats_t*) config_buffer;
+                returned->nexpressions = NEXPRESSIONS;
+                returned->expression = requested_index;
+                returned->frames = expression_frames;
+                if (requested_index < NEXPRESSIONS) {
+                    returned->evaluations = expression_evaluations[requested_index];
+                }
+                break;
+            }
+            case ConfigCommand::GET_LATENCY_HISTOGRAM: {
+                latency_histogram_t* returned = (latency_histogram_t*) config_buffer;
+                if (requested_index >= (uint8_t) LatencyStage::N) {
+                    break;
+                }
+                returned->bucket_width_us = latency_bucket_width_us[requested_index];
+                returned->nbuckets = LATENCY_BUCKETS;
+                returned->first_bucket = requested_secondary_index;
+                for (uint32_t i = 0; (i < LATENCY_BUCKETS_IN_PACKET) && (requested_secondary_index + i < LATENCY_BUCKETS); i++) {
+                    returned->counts[i] = latency_histograms[requested_index][requested_secondary_index + i];
+                }
+                break;
+            }
+            case ConfigCommand::GET_PROFILE: {
+#ifdef PROFILER_ENABLED
+                profiler_fill_stats(requested_index, (profile_stats_t*) config_buffer);
+#endif
+                break;
+            }
+            case ConfigCommand::GET_TICK_ALIGNMENT: {
+                tick_alignment_t* returned = (tick_alignment_t*) config_buffer;
+                returned->active = tick_alignment_active;
+                returned->tick_offset = tick_offset;
+                returned->host_poll_phase = host_poll_phase;
+                returned->tick_to_report_time = tick_to_report_time;
+                break;
+            }
             case ConfigCommand::PERSIST_CONFIG: {
                 persist_config_response_t* returned = (persist_config_response_t*) config_buffer;
                 if (persist_config_return_code == PersistConfigReturnCode::UNKNOWN) {
@@ -971,6 +1110,7 @@ void handle_set_report1(uint8_t report_id, uint8_t const* buffer, uint16_t bufsi
                     ignore_auth_dev_inputs = config->flags & (1 << CONFIG_FLAG_IGNORE_AUTH_DEV_INPUTS_BIT);
                     gpio_output_mode = !!(config->flags & (1 << CONFIG_FLAG_GPIO_OUTPUT_MODE_BIT));
                     normalize_gamepad_inputs = !!(config->flags & (1 << CONFIG_FLAG_NORMALIZE_GAMEPAD_INPUTS_BIT));
+                    immediate_processing = !!(config->flags & (1 << CONFIG_FLAG_IMMEDIATE_PROCESSING_BIT));
                     partial_scroll_timeout = config->partial_scroll_timeout;
                     tap_hold_threshold = config->tap_hold_threshold;
                     gpio_debounce_time = config->gpio_debounce_time_ms * 1000;
@@ -984,9 +1124,55 @@ void handle_set_report1(uint8_t report_id, uint8_t const* buffer, uint16_t bufsi
                         our_descriptor_number = 0;
                     }
                     macro_entry_duration = config->macro_entry_duration;
+                    tick_margin = config->tick_margin;
                     break;
                 }
                 case ConfigCommand::GET_CONFIG:
+                case ConfigCommand::GET_LATENCY_SAVED:
+                case ConfigCommand::GET_TICK_ALIGNMENT:
+                case ConfigCommand::GET_OUTPUT_QUEUE_STATS:
+                    break;
+                case ConfigCommand::GET_LATENCY_HISTOGRAM: {
+                    get_latency_histogram_t* get_histogram = (get_latency_histogram_t*) config_buffer->data;
+                    requested_index = get_histogram->stage;
+                    requested_secondary_index = get_histogram->first_bucket;
+                    break;
+                }
+                case ConfigCommand::RESET_LATENCY_HISTOGRAMS:
+                    memset(latency_histograms, 0, sizeof(latency_histograms));
+                    break;
+                case ConfigCommand::GET_PROFILE: {
+                    get_indexed_t* get_indexed = (get_indexed_t*) config_buffer->data;
+                    requested_index = get_indexed->requested_index;
+                    break;
+                }
+                case ConfigCommand::RESET_PROFILE:
+#ifdef PROFILER_ENABLED
+                    profiler_reset();
+#endif
+                    break;
+                case ConfigCommand::GET_OUTPUT_QUEUE_CONFIG:
+                    break;
+                case ConfigCommand::SET_OUTPUT_QUEUE_CONFIG: {
+                    output_queue_config_t* queue_config = (output_queue_config_t*) config_buffer->data;
+                    outgoing_queue_depth = queue_config->depth;
+                    if (outgoing_queue_depth < 1) {
+                        outgoing_queue_depth = 1;
+                    }
+                    if (outgoing_queue_depth > OUTGOING_QUEUE_DEPTH) {
+                        outgoing_queue_depth = OUTGOING_QUEUE_DEPTH;
+                    }
+                    outgoing_queue_keep_latest = queue_config->keep_latest;
+                    break;
+                }
+                case ConfigCommand::GET_EXPRESSION_STATS: {
+                    get_indexed_t* get_indexed = (get_indexed_t*) config_buffer->data;
+                    requested_index = get_indexed->requested_index;
+                    break;
+                }
+                case ConfigCommand::RESET_EXPRESSION_STATS:
+                    expression_frames = 0;
+                    memset(expression_evaluations, 0, sizeof(expression_evaluations));
                     break;
                 case ConfigCommand::CLEAR_MAPPING:
                     config_mappings.clear();
@@ -52,6 +52,7 @@ void mark_usage(
             .index = index,
             .count = count,
             .usage_maximum = usage_maximum,
+            .kernel = bits_kernel(bitpos, size),
         });
 }
 
@@ -17,6 +17,7 @@ enum class DualCommand : uint8_t {
     GET_FEATURE_RESPONSE = 11,
     SET_FEATURE_COMPLETE = 12,
     MIDI_RECEIVED = 13,
+    DEVICE_IDENTITY = 14,
 };
 
 struct __attribute__((packed)) device_connected_t {
@@ -105,4 +106,16 @@ struct __attribute__((packed)) midi_received_t {
     uint8_t msg[4];
 };
 
+// only used between the cores in remapper_dual_core
+struct __attribute__((packed)) device_identity_t {
+    DualCommand command = DualCommand::DEVICE_IDENTITY;
+    uint8_t interval_override;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    char manufacturer[64];
+    char product[64];
+    char serial_number[64];
+};
+
 #endif
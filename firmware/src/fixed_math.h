@@ -0,0 +1,178 @@
+#ifndef _FIXED_MATH_H_
+#define _FIXED_MATH_H_
+
+#include <stdint.h>
+
+// Integer versions of the math expressions use, working directly on the
+// *1000 scaled values. Angles are in millidegrees. RP2040 has no FPU, so
+// there this is a lot cheaper than going through soft float.
+
+#ifndef FIXED_POINT_MATH
+#if defined(PICO_RP2040) && PICO_RP2040
+#define FIXED_POINT_MATH 1
+#else
+#define FIXED_POINT_MATH 0
+#endif
+#endif
+
+// sin(d degrees) * 2^20, d = 0..90
+static const int32_t sin_table[91] = {
+    0, 18300, 36595, 54878, 73145, 91389, 109606, 127789, 145934, 164033,
+    182083, 200078, 218011, 235878, 253673, 271391, 289027, 306574, 324028, 341383,
+    358634, 375776, 392803, 409711, 426494, 443147, 459665, 476044, 492277, 508360,
+    524288, 540057, 555661, 571095, 586356, 601438, 616338, 631049, 645568, 659890,
+    674012, 687928, 701634, 715127, 728402, 741455, 754282, 766880, 779244, 791370,
+    803256, 814897, 826289, 837430, 848316, 858943, 869309, 879410, 889243, 898805,
+    908093, 917105, 925838, 934288, 942454, 950333, 957922, 965219, 972223, 978930,
+    985339, 991448, 997255, 1002758, 1007956, 1012847, 1017429, 1021701, 1025662, 1029311,
+    1032646, 1035666, 1038371, 1040760, 1042832, 1044586, 1046022, 1047139, 1047937, 1048416,
+    1048576
+};
+
+// atan(2^-i) in 1/256 millidegrees
+static const int32_t cordic_angles[24] = {
+    11520000, 6800653, 3593278, 1824004, 915542, 458217, 229164, 114589,
+    57295, 28648, 14324, 7162, 3581, 1790, 895, 448,
+    224, 112, 56, 28, 14, 7, 3, 2
+};
+
+inline int32_t fixed_sin(int32_t angle) {
+    angle %= 360000;
+    if (angle < 0) {
+        angle += 360000;
+    }
+    bool negative = false;
+    if (angle >= 180000) {
+        angle -= 180000;
+        negative = true;
+    }
+    if (angle > 90000) {
+        angle = 180000 - angle;
+    }
+    int32_t degrees = angle / 1000;
+    int32_t fraction = angle % 1000;
+    int32_t value = sin_table[degrees];
+    if (fraction != 0) {
+        value += (sin_table[degrees + 1] - value) * fraction / 1000;
+    }
+    int32_t result = (value * 1000) >> 20;
+    return negative ? -result : result;
+}
+
+inline int32_t fixed_cos(int32_t angle) {
+    return fixed_sin(angle % 360000 + 90000);
+}
+
+// CORDIC in vectoring mode, result in (-180000, 180000].
+inline int32_t fixed_atan2(int32_t y_in, int32_t x_in) {
+    if ((x_in == 0) && (y_in == 0)) {
+        return 0;
+    }
+    int64_t x = x_in;
+    int64_t y = y_in;
+    int32_t angle = 0;
+    if (x < 0) {
+        x = -x;
+        y = -y;
+        angle = (y_in >= 0) ? 180000 * 256 : -180000 * 256;
+    }
+
+    // scale so that the largest coordinate is in [2^28, 2^29), leaving
+    // headroom for the CORDIC gain
+    uint64_t magnitude = (x > (y < 0 ? -y : y)) ? x : (y < 0 ? -y : y);
+    while (magnitude >= ((uint64_t) 1 << 29)) {
+        magnitude >>= 1;
+        x >>= 1;
+        y >>= 1;
+    }
+    while (magnitude < ((uint64_t) 1 << 28)) {
+        magnitude <<= 1;
+        x <<= 1;
+        y <<= 1;
+    }
+
+    int32_t xi = x;
+    int32_t yi = y;
+    for (int i = 0; i < 24; i++) {
+        int32_t x_shifted = xi >> i;
+        int32_t y_shifted = yi >> i;
+        if (yi > 0) {
+            xi += y_shifted;
+            yi -= x_shifted;
+            angle += cordic_angles[i];
+        } else {
+            xi -= y_shifted;
+            yi += x_shifted;
+            angle -= cordic_angles[i];
+        }
+    }
+    return angle / 256;
+}
+
+inline uint32_t isqrt32(uint32_t n) {
+    uint32_t result = 0;
+    uint32_t bit = (uint32_t) 1 << 30;
+    while (bit > n) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (n >= result + bit) {
+            n -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+inline uint32_t isqrt64(uint64_t n) {
+    if (n <= 0xFFFFFFFF) {
+        return isqrt32(n);
+    }
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+    while (bit > n) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (n >= result + bit) {
+            n -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+// sqrt(value / 1000) * 1000, value >= 0
+inline int32_t fixed_sqrt(int32_t value) {
+    return isqrt64((uint64_t) value * 1000);
+}
+
+// Truncated float * 1000, saturating like the hardware conversion does.
+inline int32_t fixed_from_fp32(uint32_t bits) {
+    int32_t exponent = (bits >> 23) & 0xFF;
+    if (exponent == 0xFF) {
+        if (bits & 0x7FFFFF) {  // NaN
+            return 0;
+        }
+        return (bits & 0x80000000) ? INT32_MIN : INT32_MAX;
+    }
+    if (exponent == 0) {  // zero or too small to matter
+        return 0;
+    }
+    // anything from 2^23 up is out of range once multiplied by 1000
+    int32_t shift = 127 + 23 - exponent;
+    uint64_t value = (uint64_t) ((bits & 0x7FFFFF) | 0x800000) * 1000;
+    value = (shift <= 0) ? ((uint64_t) 1 << 32) : (shift < 64) ? (value >> shift) : 0;
+    if (bits & 0x80000000) {
+        return (value > (uint64_t) 1 << 31) ? INT32_MIN : (int32_t) -(int64_t) value;
+    }
+    return (value > INT32_MAX) ? INT32_MAX : (int32_t) value;
+}
+
+#endif
@@ -32,17 +32,39 @@ bool ignore_auth_dev_inputs = false;
 uint8_t macro_entry_duration = 0;  // 0 means 1ms
 uint8_t gpio_output_mode = 0;
 bool normalize_gamepad_inputs = true;
+bool immediate_processing = false;
+uint8_t tick_margin = 0;  // in 10us units, 0 means fixed tick timing
 
 std::vector<mapping_config11_t> config_mappings;
 
 uint8_t resolution_multiplier = 0;
 
+uint32_t immediate_runs = 0;  // process_mapping() calls made on report arrival
+uint64_t latency_saved = 0;   // microseconds until the frame-aligned tick would have come
+
+uint32_t reports_merged = 0;   // outgoing reports folded into one that was already queued
+uint32_t reports_dropped = 0;  // outgoing states replaced or held back because the queue was full
+
+uint8_t outgoing_queue_depth = OUTGOING_QUEUE_DEPTH;            // entries used per report ID, at most OUTGOING_QUEUE_DEPTH
+bool outgoing_queue_keep_latest = OUTGOING_QUEUE_KEEP_LATEST;  // when full: replace the newest state instead of folding ones without edges
+
+const uint16_t latency_bucket_width_us[(uint8_t) LatencyStage::N] = { 50, 10, 250, 250, 250 };
+uint32_t latency_histograms[(uint8_t) LatencyStage::N][LATENCY_BUCKETS] = { 0 };
+
+// all in microseconds relative to the host's SOF
+volatile bool tick_alignment_active = false;
+volatile uint16_t tick_offset = 0;
+uint16_t host_poll_phase = 0;
+uint16_t tick_to_report_time = 0;
+
 // 设备克隆信息实例
 cloned_device_info_t cloned_device;
 
 std::vector<std::vector<uint32_t>> macros[NMACROS];
 
 std::vector<expr_elem_t> expressions[NEXPRESSIONS];
+uint32_t expression_frames = 0;                          // times process_mapping() went through the expressions
+uint32_t expression_evaluations[NEXPRESSIONS] = { 0 };  // times each one was actually evaluated
 
 bool monitor_enabled = false;
 
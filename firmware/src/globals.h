@@ -39,21 +39,35 @@ extern bool ignore_auth_dev_inputs;
 extern uint8_t macro_entry_duration;
 extern uint8_t gpio_output_mode;
 extern bool normalize_gamepad_inputs;
+extern bool immediate_processing;
+extern uint8_t tick_margin;
 
 extern std::vector<mapping_config11_t> config_mappings;
 
 extern uint8_t resolution_multiplier;
 
-// 设备克隆信息
-struct cloned_device_info_t {
-    uint16_t vid = 0;
-    uint16_t pid = 0;
-    uint16_t bcd_device = 0x0100;
-    char manufacturer[64] = {0};
-    char product[64] = {0};
-    char serial_number[64] = {0};
-    bool is_cloned = false;
-};
+extern uint32_t immediate_runs;
+extern uint64_t latency_saved;
+
+extern uint32_t reports_merged;
+extern uint32_t reports_dropped;
+
+#ifndef OUTGOING_QUEUE_DEPTH
+#define OUTGOING_QUEUE_DEPTH 8
+#endif
+#ifndef OUTGOING_QUEUE_KEEP_LATEST
+#define OUTGOING_QUEUE_KEEP_LATEST 0
+#endif
+extern uint8_t outgoing_queue_depth;
+extern bool outgoing_queue_keep_latest;
+
+extern const uint16_t latency_bucket_width_us[(uint8_t) LatencyStage::N];
+extern uint32_t latency_histograms[(uint8_t) LatencyStage::N][LATENCY_BUCKETS];
+
+extern volatile bool tick_alignment_active;
+extern volatile uint16_t tick_offset;
+extern uint16_t host_poll_phase;
+extern uint16_t tick_to_report_time;
 
 extern cloned_device_info_t cloned_device;
 
@@ -63,6 +77,8 @@ extern std::vector<std::vector<uint32_t>> macros[NMACROS];
 
 #define NEXPRESSIONS 8
 extern std::vector<expr_elem_t> expressions[NEXPRESSIONS];
+extern uint32_t expression_frames;
+extern uint32_t expression_evaluations[NEXPRESSIONS];
 
 extern bool monitor_enabled;
 
@@ -30,6 +30,7 @@
 #include "mcp4651.h"
 #include "our_descriptor.h"
 #include "platform.h"
+#include "profiler.h"
 #include "remapper.h"
 #include "tick.h"
 
@@ -49,6 +50,9 @@
 
 uint64_t next_print = 0;
 
+uint32_t immediate_runs_since_tick = 0;
+uint64_t immediate_run_times_since_tick = 0;
+
 mutex_t mutexes[(uint8_t) MutexId::N];
 
 uint32_t gpio_valid_pins_mask = 0;
@@ -66,6 +70,9 @@ void print_stats_maybe() {
     uint64_t now = time_us_64();
     if (now > next_print) {
         print_stats();
+#ifdef PROFILER_ENABLED
+        profiler_start_stream();
+#endif
         while (next_print < now) {
             next_print += 1000000;
         }
@@ -164,7 +171,6 @@ void write_gpio() {
             gpio_set_dir_masked(gpio_out_mask, value);
             break;
     }
-    memset(gpio_out_state, 0, sizeof(gpio_out_state));
 }
 
 #ifdef ADC_ENABLED
@@ -246,6 +252,9 @@ int main() {
     adc_pins_init();
 #endif
     tick_init();
+#ifdef PROFILER_ENABLED
+    profiler_init();
+#endif
     load_config(FLASH_CONFIG_IN_MEMORY);
     our_descriptor = &our_descriptors[our_descriptor_number];
     parse_our_descriptor();
@@ -271,35 +280,60 @@ int main() {
     next_print = time_us_64() + 1000000;
 
     while (true) {
+        PROFILE_SCOPE(LOOP);
         bool tick;
         bool new_report;
-        read_report(&new_report, &tick);
+        PROFILED(READ_REPORT, read_report(&new_report, &tick));
         if (new_report) {
             activity_led_on();
         }
         if (their_descriptor_updated) {
-            update_their_descriptor_derivates();
+            PROFILED(DESCRIPTOR_UPDATE, update_their_descriptor_derivates());
             their_descriptor_updated = false;
         }
         if (tick) {
-            bool gpio_state_changed = read_gpio(time_us_64());
+            uint64_t now = time_us_64();
+            bool gpio_state_changed;
+            PROFILED(READ_GPIO, gpio_state_changed = read_gpio(now));
             if (gpio_state_changed) {
                 activity_led_on();
             }
 #ifdef ADC_ENABLED
-            read_adc();
+            PROFILED(READ_ADC, read_adc());
+#endif
+            PROFILED(PROCESS_MAPPING, process_mapping(true));
+            PROFILED(WRITE_GPIO, write_gpio());
+#ifdef MCP4651_ENABLED
+            PROFILED(MCP4651_WRITE, mcp4651_write());
 #endif
-            process_mapping(true);
-            write_gpio();
+            if (tud_hid_n_ready(0)) {
+                PROFILED(SEND_REPORT, send_report(do_send_report));
+            }
+            tick_processed();
+            // without immediate processing these reports would have waited for this tick
+            latency_saved += immediate_runs_since_tick * now - immediate_run_times_since_tick;
+            immediate_runs_since_tick = 0;
+            immediate_run_times_since_tick = 0;
+        } else if (new_report && immediate_processing) {
+            uint64_t now = time_us_64();
+            // time-based features still advance on the tick only
+            PROFILED(PROCESS_MAPPING, process_mapping(false));
+            PROFILED(WRITE_GPIO, write_gpio());
 #ifdef MCP4651_ENABLED
-            mcp4651_write();
+            PROFILED(MCP4651_WRITE, mcp4651_write());
 #endif
+            if (tud_hid_n_ready(0)) {
+                PROFILED(SEND_REPORT, send_report(do_send_report));
+            }
+            immediate_runs++;
+            immediate_runs_since_tick++;
+            immediate_run_times_since_tick += now;
         }
-        tud_task();
+        PROFILED(TUD_TASK, tud_task());
 
         // 处理串口HID控制命令
 #ifdef ENABLE_SERIAL_HID_CONTROL
-        serial_hid_control_task();
+        PROFILED(SERIAL_HID_CONTROL, serial_hid_control_task());
 #endif
 
         if (boot_protocol_updated) {
@@ -320,17 +354,20 @@ int main() {
             set_gpio_dir_pending = false;
         }
         if (tud_hid_n_ready(0)) {
-            send_report(do_send_report);
+            PROFILED(SEND_REPORT, send_report(do_send_report));
         }
+#ifdef PROFILER_ENABLED
+        profiler_stream();
+#endif
         if (monitor_enabled && tud_hid_n_ready(1)) {
             send_monitor_report(do_send_report);
         }
         if (our_descriptor->main_loop_task != nullptr) {
             our_descriptor->main_loop_task();
         }
-        send_out_report();
+        PROFILED(SEND_OUT_REPORT, send_out_report());
         if (need_to_persist_config) {
-            persist_config_return_code = persist_config();
+            PROFILED(PERSIST_CONFIG, persist_config_return_code = persist_config());
             need_to_persist_config = false;
         }
 
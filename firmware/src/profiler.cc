@@ -0,0 +1,187 @@
+#ifdef PROFILER_ENABLED
+
+#include "profiler.h"
+
+#include <cstring>
+
+#include "globals.h"
+#include "remapper.h"
+
+#if PICO_ON_DEVICE
+#include <hardware/clocks.h>
+#include <hardware/structs/systick.h>
+#else
+#include <time.h>
+#endif
+
+// Durations are in cycles of the system clock on the device (SysTick, it
+// counts down and wraps at 24 bits) and in nanoseconds on the host.
+
+#define PROFILER_BUCKETS 96
+#define FRAME_BUDGET_US 1000
+
+struct profile_stage_stats_t {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[PROFILER_BUCKETS];
+};
+
+static profile_stage_stats_t stage_stats[(uint8_t) ProfileStage::N];
+static uint32_t overruns = 0;
+static uint32_t ticks_per_us = 0;
+
+#define PROFILER_STREAM_FIELDS 3
+#define PROFILER_STREAM_ITEMS ((uint8_t) ProfileStage::N * PROFILER_STREAM_FIELDS + 1)
+
+static uint32_t stream_idx = PROFILER_STREAM_ITEMS;
+
+void profiler_init() {
+#if PICO_ON_DEVICE
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0b101;  // processor clock, no interrupt, enabled
+    ticks_per_us = clock_get_hz(clk_sys) / 1000000;
+#else
+    ticks_per_us = 1000;
+#endif
+    profiler_reset();
+}
+
+uint32_t profiler_now() {
+#if PICO_ON_DEVICE
+    return systick_hw->cvr;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static uint32_t elapsed_since(uint32_t start) {
+#if PICO_ON_DEVICE
+    return (start - systick_hw->cvr) & 0x00FFFFFF;
+#else
+    return profiler_now() - start;
+#endif
+}
+
+// Four buckets per power of two, so a percentile read from the buckets is
+// off by at most 25%.
+static uint32_t bucket_for(uint32_t value) {
+    if (value < 4) {
+        return value;
+    }
+    uint32_t msb = 31 - __builtin_clz(value);
+    uint32_t bucket = (msb - 1) * 4 + ((value >> (msb - 2)) & 3);
+    return (bucket < PROFILER_BUCKETS) ? bucket : PROFILER_BUCKETS - 1;
+}
+
+static uint32_t bucket_upper_bound(uint32_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    uint32_t msb = bucket / 4 + 1;
+    uint32_t sub = bucket % 4;
+    return (((4 + sub + 1) << (msb - 2)) - 1);
+}
+
+void profiler_record(ProfileStage stage, uint32_t start) {
+    uint32_t elapsed = elapsed_since(start);
+    profile_stage_stats_t& stats = stage_stats[(uint8_t) stage];
+    stats.count++;
+    stats.total += elapsed;
+    if (elapsed < stats.min) {
+        stats.min = elapsed;
+    }
+    if (elapsed > stats.max) {
+        stats.max = elapsed;
+    }
+    stats.buckets[bucket_for(elapsed)]++;
+    // a loop iteration longer than a frame means the next tick was late
+    if ((stage == ProfileStage::LOOP) && (elapsed > FRAME_BUDGET_US * ticks_per_us)) {
+        overruns++;
+    }
+}
+
+static uint32_t percentile(const profile_stage_stats_t& stats, uint32_t permille) {
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < PROFILER_BUCKETS; i++) {
+        seen += stats.buckets[i];
+        if (seen * 1000 >= (uint64_t) stats.count * permille) {
+            uint32_t bound = bucket_upper_bound(i);
+            return (bound < stats.max) ? bound : stats.max;
+        }
+    }
+    return stats.max;
+}
+
+void profiler_fill_stats(uint32_t stage, profile_stats_t* returned) {
+    if (stage >= (uint8_t) ProfileStage::N) {
+        return;
+    }
+    const profile_stage_stats_t& stats = stage_stats[stage];
+    returned->nstages = (uint8_t) ProfileStage::N;
+    returned->stage = stage;
+    returned->ticks_per_us = ticks_per_us;
+    returned->count = stats.count;
+    returned->min = (stats.count > 0) ? stats.min : 0;
+    returned->max = stats.max;
+    returned->avg = (stats.count > 0) ? stats.total / stats.count : 0;
+    returned->p99 = percentile(stats, 990);
+    returned->overruns = overruns;
+}
+
+void profiler_reset() {
+    memset(stage_stats, 0, sizeof(stage_stats));
+    for (auto& stats : stage_stats) {
+        stats.min = UINT32_MAX;
+    }
+    overruns = 0;
+}
+
+void profiler_start_stream() {
+    stream_idx = 0;
+}
+
+// Called from the main loop. After profiler_start_stream(), sends average,
+// p99 and maximum time per stage (in ns) and the overrun count through the
+// monitor interface, a few items at a time as they fit.
+void profiler_stream() {
+    if (!monitor_enabled) {
+        return;
+    }
+    while (stream_idx < PROFILER_STREAM_ITEMS) {
+        uint32_t usage;
+        int32_t value;
+        if (stream_idx == PROFILER_STREAM_ITEMS - 1) {
+            usage = PROFILER_USAGE_PAGE | 0xFFFF;
+            value = overruns;
+        } else {
+            uint8_t stage = stream_idx / PROFILER_STREAM_FIELDS;
+            uint8_t field = stream_idx % PROFILER_STREAM_FIELDS;
+            const profile_stage_stats_t& stats = stage_stats[stage];
+            uint32_t ticks = 0;
+            switch (field) {
+                case 0:
+                    ticks = (stats.count > 0) ? stats.total / stats.count : 0;
+                    break;
+                case 1:
+                    ticks = percentile(stats, 990);
+                    break;
+                case 2:
+                    ticks = stats.max;
+                    break;
+            }
+            usage = PROFILER_USAGE_PAGE | (field << 8) | stage;
+            value = (uint64_t) ticks * 1000 / ticks_per_us;
+        }
+        if (!monitor_usage(usage, value, 0)) {
+            break;
+        }
+        stream_idx++;
+    }
+}
+
+#endif
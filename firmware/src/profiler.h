@@ -0,0 +1,54 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+// Main loop profiler. Everything here compiles to nothing unless
+// PROFILER_ENABLED is defined.
+
+#ifdef PROFILER_ENABLED
+
+void profiler_init();
+uint32_t profiler_now();
+void profiler_record(ProfileStage stage, uint32_t start);
+void profiler_fill_stats(uint32_t stage, profile_stats_t* stats);
+void profiler_reset();
+void profiler_start_stream();
+void profiler_stream();
+
+struct profile_scope_t {
+    ProfileStage stage;
+    uint32_t start;
+
+    profile_scope_t(ProfileStage stage_)
+        : stage(stage_), start(profiler_now()) {
+    }
+
+    ~profile_scope_t() {
+        profiler_record(stage, start);
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// times from here to the end of the enclosing scope
+#define PROFILE_SCOPE(stage) profile_scope_t PROFILE_CONCAT(profile_scope_, __LINE__)(ProfileStage::stage)
+#define PROFILED(stage, statement) \
+    do {                           \
+        PROFILE_SCOPE(stage);      \
+        statement;                 \
+    } while (0)
+
+#else
+
+#define PROFILE_SCOPE(stage)
+#define PROFILED(stage, statement) \
+    do {                           \
+        statement;                 \
+    } while (0)
+
+#endif
+
+#endif
@@ -651,6 +651,17 @@ uint32_t xbox_mapping7[][2] = {
     { 0x0009000d, 0x00090011 },
 };
 
+const quirk_descriptor_t quirk_descriptors[] = {
+    { VENDOR_ID_ELECOM, PRODUCT_ID_ELECOM_M_XT3URBK, elecom_huge_descriptor, sizeof(elecom_huge_descriptor) },
+    { VENDOR_ID_ELECOM, PRODUCT_ID_ELECOM_M_HT1DRBK_011C, elecom_huge_descriptor2, sizeof(elecom_huge_descriptor2) },
+    { VENDOR_ID_KENSINGTON, PRODUCT_ID_KENSINGTON_SLIMBLADE, kensington_slimblade_descriptor, sizeof(kensington_slimblade_descriptor) },
+    { VENDOR_ID_CH_PRODUCTS, PRODUCT_ID_CH_PRODUCTS_DT225, ch_products_dt225_descriptor, sizeof(ch_products_dt225_descriptor) },
+    { VENDOR_ID_3DCONNEXION, PRODUCT_ID_3DCONNEXION_SPACEMOUSE_COMPACT, spacemouse_compact_descriptor, sizeof(spacemouse_compact_descriptor) },
+    { VENDOR_ID_3DCONNEXION, PRODUCT_ID_3DCONNEXION_SPACEMOUSE_PRO, spacemouse_pro_descriptor, sizeof(spacemouse_pro_descriptor) },
+};
+
+const uint8_t nquirk_descriptors = sizeof(quirk_descriptors) / sizeof(quirk_descriptors[0]);
+
 void gamepad_normalize(std::unordered_map<uint32_t, usage_def_t>& current_map, uint32_t mapping[][2], uint16_t nentries) {
     auto new_map = current_map;
 
@@ -822,6 +833,7 @@ void apply_quirks(uint16_t vendor_id, uint16_t product_id, std::unordered_map<ui
                     .bitpos = quirk->bitpos,
                     .is_relative = (quirk->size_flags & QUIRK_FLAG_RELATIVE_MASK) != 0,
                     .logical_minimum = ((quirk->size_flags & QUIRK_FLAG_SIGNED_MASK) != 0) ? -1 : 0,
+                    .kernel = bits_kernel(quirk->bitpos, quirk_size),
                 };
             } else {
                 usage_map[quirk->report_id].erase(quirk->usage);
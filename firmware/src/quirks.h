@@ -5,6 +5,17 @@
 #include <unordered_map>
 #include "types.h"
 
+struct quirk_descriptor_t {
+    uint16_t vendor_id;
+    uint16_t product_id;
+    const uint8_t* descriptor;
+    uint16_t len;
+};
+
+// The report descriptors that the built-in quirks match against.
+extern const quirk_descriptor_t quirk_descriptors[];
+extern const uint8_t nquirk_descriptors;
+
 void apply_quirks(uint16_t vendor_id, uint16_t product_id, std::unordered_map<uint8_t, std::unordered_map<uint32_t, usage_def_t>>& usage_map, const uint8_t* report_descriptor, int len, uint8_t itf_num);
 
 #endif
@@ -1,34 +1,42 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <queue>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "bits.h"
 #include "config.h"
 #include "crc.h"
 #include "descriptor_parser.h"
+#include "fixed_math.h"
 #include "globals.h"
 #include "our_descriptor.h"
 #include "platform.h"
 #include "remapper.h"
 
 #define MAX_REPORT_SIZE 64
+#define MAX_REPORT_WORDS (MAX_REPORT_SIZE / 4)
 
 const uint8_t MAPPING_FLAG_STICKY = 1 << 0;
 const uint8_t MAPPING_FLAG_TAP = 1 << 1;
 const uint8_t MAPPING_FLAG_HOLD = 1 << 2;
 
+const uint8_t SOURCE_FLAG_TAP = 1 << 0;
+const uint8_t SOURCE_FLAG_HOLD = 1 << 1;
+const uint8_t SOURCE_FLAG_RELATIVE = 1 << 2;
+
 const uint8_t V_RESOLUTION_BITMASK = (1 << 0);
 const uint8_t H_RESOLUTION_BITMASK = (1 << 2);
 const uint32_t V_SCROLL_USAGE = 0x00010038;
 const uint32_t H_SCROLL_USAGE = 0x000C0238;
 
-const uint8_t NLAYERS = 4;
+const uint8_t NLAYERS = 8;
 const uint32_t LAYERS_USAGE_PAGE = 0xFFF10000;
 const uint32_t MACRO_USAGE_PAGE = 0xFFF20000;
 const uint32_t EXPR_USAGE_PAGE = 0xFFF30000;
@@ -48,63 +56,134 @@ std::vector<reverse_mapping_t> reverse_mapping;
 std::vector<reverse_mapping_t> reverse_mapping_macros;
 std::vector<reverse_mapping_t> reverse_mapping_layers;
 
+mapping_program_t mapping_program;  // compiled from reverse_mapping
+
 std::unordered_map<uint8_t, std::unordered_map<uint32_t, usage_def_t>> our_usages;  // report_id -> usage -> usage_def
 std::unordered_map<uint32_t, usage_def_t> our_usages_flat;
 bool have_dpad = false;
 usage_def_t our_dpad_usage;  // only valid if have_dpad is true
 
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_usage_def_t>>> their_used_usages;  // dev_addr+interface -> report_id -> (usage, usage_def) vector
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<int32_t*>>> array_range_usages;          // dev_addr+interface -> report_id -> input_state ptr vector
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_def_t>>> rollover_usages;          // dev_addr+interface -> report_id -> usage_def vector
+// The report path reads whichever of these is active without taking any locks.
+// update_their_descriptor_derivates() fills the other one and then swaps the
+// pointer, so a report never sees half-built tables. Nothing tracks readers
+// though: the next rebuild reuses the inactive tables straight away, which is
+// only safe because every build calls do_handle_received_report() and
+// update_their_descriptor_derivates() from the same thread (the main loop on
+// core0, or the main thread on nRF52). Decoding on another thread would need
+// a reader generation check before the inactive tables are cleared.
+decode_tables_t decode_tables[2];
+std::atomic<decode_tables_t*> active_decode_tables{ &decode_tables[0] };
+std::vector<button_run_state_t> button_run_states;  // indexed like the active tables' button_runs
+uint32_t decoded_arrays[MAX_DECODED_ARRAYS][8];  // 256-bit sets of the indexes present in the current report's array fields
 
 std::vector<sticky_usage_t> sticky_usages;
 std::vector<tap_hold_sticky_usage_t> tap_sticky_usages;
 std::vector<tap_hold_sticky_usage_t> hold_sticky_usages;
 std::vector<tap_hold_usage_t> tap_hold_usages;
+binary_sources_t binary_sources;
 
 std::vector<usage_usage_def_t> our_array_range_usages;
 
 // report_id -> ...
+// Report buffers and masks are allocated as whole words, the padding stays zero.
 uint8_t* reports[MAX_INPUT_REPORT_ID + 1];
 uint8_t* prev_reports[MAX_INPUT_REPORT_ID + 1];
-uint8_t* report_masks_relative[MAX_INPUT_REPORT_ID + 1];
-uint8_t* report_masks_absolute[MAX_INPUT_REPORT_ID + 1];
+uint32_t* report_masks_relative[MAX_INPUT_REPORT_ID + 1];
+uint32_t* report_masks_absolute[MAX_INPUT_REPORT_ID + 1];
 uint16_t report_sizes[MAX_INPUT_REPORT_ID + 1];
-
-#define OR_BUFSIZE 8
-uint8_t outgoing_reports[OR_BUFSIZE][MAX_REPORT_SIZE + 1];
-uint8_t or_head = 0;
-uint8_t or_tail = 0;
-uint8_t or_items = 0;
+uint8_t report_words[MAX_INPUT_REPORT_ID + 1];
+std::vector<usage_def_t> our_relative_usages[MAX_INPUT_REPORT_ID + 1];
+
+// Each report ID has its own queue of distinct absolute states, relative
+// values are summed into the newest one. The queues are allocated for
+// OUTGOING_QUEUE_DEPTH entries, outgoing_queue_depth says how many are used.
+// What happens when a queue is full depends on outgoing_queue_keep_latest,
+// see queue_outgoing_report(). There's one more slot after the queued
+// entries for a state that has to wait until the queue has room.
+#define OUTGOING_QUEUE_SLOTS (OUTGOING_QUEUE_DEPTH + 1)
+// report ID goes in the last byte of the first word, so the report itself is word-aligned
+uint32_t outgoing_reports[MAX_INPUT_REPORT_ID + 1][OUTGOING_QUEUE_SLOTS][MAX_REPORT_WORDS + 1];
+struct outgoing_report_meta_t {
+    uint32_t seq;          // send order across report IDs
+    uint64_t input_time;   // oldest received report that went into it, 0 if none
+    uint64_t queued_time;
+};
+outgoing_report_meta_t outgoing_meta[MAX_INPUT_REPORT_ID + 1][OUTGOING_QUEUE_SLOTS];
+uint8_t or_head[MAX_INPUT_REPORT_ID + 1] = { 0 };
+uint8_t or_items[MAX_INPUT_REPORT_ID + 1] = { 0 };
+bool or_pending[MAX_INPUT_REPORT_ID + 1] = { false };  // entry at or_items is waiting for room
+uint32_t or_total_items = 0;
+uint32_t or_next_seq = 0;
+
+// The passthrough device's newest report, when even the slot after the
+// queue couldn't take it. There's no input_state to compute it from again,
+// so process_mapping() retries it until it's queued or a newer one is.
+uint32_t held_passthrough_reports[MAX_INPUT_REPORT_ID + 1][MAX_REPORT_WORDS];
+uint64_t held_passthrough_input_time[MAX_INPUT_REPORT_ID + 1];
+uint8_t held_passthrough_mask = 0;  // by report ID
+
+// The passthrough device's reports don't go into input_state. Its last
+// absolute state is kept so it can be decoded when that stops.
+uint8_t last_passthrough_reports[MAX_INPUT_REPORT_ID + 1][MAX_REPORT_SIZE];
+uint8_t last_passthrough_lens[MAX_INPUT_REPORT_ID + 1];
+uint8_t last_passthrough_mask = 0;  // by report ID
 
 std::vector<uint8_t> report_ids;
 
+uint64_t report_received_time = 0;        // the report being handled right now
+uint64_t first_unprocessed_report_time = 0;  // oldest report process_mapping() hasn't seen yet
+uint64_t in_flight_input_time = 0;
+uint64_t in_flight_send_time = 0;
+
 #define MAX_INPUT_STATES 1024
 #define PREV_STATE_OFFSET MAX_INPUT_STATES
 
 int32_t input_state[MAX_INPUT_STATES * 2];
 tap_hold_state_t tap_hold_state[MAX_INPUT_STATES];
-uint8_t sticky_state[MAX_INPUT_STATES];                  // state per layer (mask)
-std::unordered_map<uint64_t, int32_t*> usage_state_ptr;  // usage -> input_state pointer
+uint8_t sticky_state[MAX_INPUT_STATES];  // state per layer (mask)
 uint32_t used_state_slots = 0;
+uint32_t dirty_slots[MAX_INPUT_STATES / 32];  // slots that changed since the last process_mapping()
+
+// Open addressing hash of (raw, hub_port, usage) -> input_state slot. Sized at least
+// twice MAX_INPUT_STATES so it never fills up and probe sequences stay short.
+#define STATE_SLOT_INDEX_BITS 11
+#define STATE_SLOT_INDEX_SIZE (1 << STATE_SLOT_INDEX_BITS)
+uint16_t state_slot_index[STATE_SLOT_INDEX_SIZE];  // slot + 1, 0 means empty
+uint64_t state_slot_keys[MAX_INPUT_STATES];
 
-std::unordered_map<uint32_t, int32_t> accumulated;  // usage -> relative movement, * 1000
 uint8_t layer_state_mask = 1;
 
+// what the mapping results depended on when they were last computed
+uint8_t mapped_layer_state_mask = 0;
+uint16_t mapped_active_ports_mask = 0;
+bool mapped_auto_repeat = false;
+// relative movement, macros and overflows mean the next frame can produce different reports
+// even if no inputs change
+bool refresh_next_frame = true;
+
 std::vector<int32_t*> relative_usages;  // input_state pointers
 
-struct macro_entry_t {
+struct macro_cursor_t {
+    uint8_t macro;
+    uint8_t duration;  // per step
     uint8_t duration_left;
-    std::vector<uint32_t> items;
+    uint16_t step;
 };
 
-std::queue<macro_entry_t> macro_queue;
+#define MACRO_QUEUE_SIZE 16
+macro_cursor_t macro_queue[MACRO_QUEUE_SIZE];
+uint8_t macro_queue_head = 0;
+uint8_t macro_queue_items = 0;
 
 uint32_t reports_received;
 uint32_t reports_sent;
 uint32_t processing_time;
 
 bool expression_valid[NEXPRESSIONS] = { false };
+bool expression_debug[NEXPRESSIONS] = { false };
+std::vector<expr_elem_t> compiled_expressions[NEXPRESSIONS];
+expr_schedule_t expression_schedule[NEXPRESSIONS];
+uint32_t expression_result_slots = 0;  // used_state_slots when expression results were looked up
 
 std::unordered_map<uint32_t, int32_t> monitor_input_state;
 uint8_t monitor_usages_queued = 0;
@@ -125,66 +204,55 @@ uint16_t active_ports_mask = 0;
 
 uint8_t dpad_state = 0;
 
-inline int32_t handle_scroll(map_source_t& map_source, uint32_t target_usage, int32_t movement, uint64_t now) {
+inline int32_t handle_scroll(int32_t& accumulated_scroll, uint64_t& last_scroll_timestamp, uint32_t target_usage, int32_t movement, uint64_t now) {
     // movement is always non-zero
     int32_t ret = 0;
     if (resolution_multiplier &
         resolution_multiplier_masks[target_usage == H_SCROLL_USAGE]) {  // hi-res
         ret = movement;
     } else {  // lo-res
-        if ((map_source.accumulated_scroll != 0) &&
-            (now - map_source.last_scroll_timestamp > partial_scroll_timeout)) {
-            map_source.accumulated_scroll = 0;
-        }
-        map_source.last_scroll_timestamp = now;
-        map_source.accumulated_scroll += movement;
-        int ticks = map_source.accumulated_scroll / (1000 * RESOLUTION_MULTIPLIER);
-        map_source.accumulated_scroll -= ticks * (1000 * RESOLUTION_MULTIPLIER);
+        if ((accumulated_scroll != 0) &&
+            (now - last_scroll_timestamp > partial_scroll_timeout)) {
+            accumulated_scroll = 0;
+        }
+        last_scroll_timestamp = now;
+        accumulated_scroll += movement;
+        int ticks = accumulated_scroll / (1000 * RESOLUTION_MULTIPLIER);
+        accumulated_scroll -= ticks * (1000 * RESOLUTION_MULTIPLIER);
         ret = ticks * 1000;
     }
     return ret;
 }
 
-inline int8_t get_bit(const uint8_t* data, int len, uint16_t bitpos) {
-    int byte_no = bitpos / 8;
-    int bit_no = bitpos % 8;
-    if (byte_no < len) {
-        return (data[byte_no] & 1 << bit_no) ? 1 : 0;
-    }
-    return 0;
+// idx counts from the oldest queued report
+inline uint32_t* outgoing_report(uint8_t report_id, uint8_t idx) {
+    return outgoing_reports[report_id][(or_head[report_id] + idx) % OUTGOING_QUEUE_SLOTS];
 }
 
-inline uint32_t get_bits(const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
-    uint32_t value = 0;
-    for (int i = 0; i < size; i++) {
-        value |= get_bit(data, len, bitpos + i) << i;
-    }
-    return value;
+inline outgoing_report_meta_t& outgoing_report_meta(uint8_t report_id, uint8_t idx) {
+    return outgoing_meta[report_id][(or_head[report_id] + idx) % OUTGOING_QUEUE_SLOTS];
 }
 
-inline void put_bit(uint8_t* data, int len, uint16_t bitpos, uint8_t value) {
-    int byte_no = bitpos / 8;
-    int bit_no = bitpos % 8;
-    if (byte_no < len) {
-        data[byte_no] &= ~(1 << bit_no);
-        data[byte_no] |= (value & 1) << bit_no;
+void record_latency(LatencyStage stage, uint64_t duration) {
+    uint32_t bucket = duration / latency_bucket_width_us[(uint8_t) stage];
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
     }
+    latency_histograms[(uint8_t) stage][bucket]++;
 }
 
-inline void put_bits(uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
-    for (int i = 0; i < size; i++) {
-        put_bit(data, len, bitpos + i, (value >> i) & 1);
-    }
+inline uint8_t* outgoing_report_with_id(uint32_t* entry) {
+    return (uint8_t*) entry + 3;
 }
 
 bool needs_to_be_sent(uint8_t report_id) {
-    uint8_t* report = reports[report_id];
-    uint8_t* prev_report = prev_reports[report_id];
-    uint8_t* relative = report_masks_relative[report_id];
-    uint8_t* absolute = report_masks_absolute[report_id];
+    const uint32_t* report = (uint32_t*) reports[report_id];
+    const uint32_t* prev_report = (uint32_t*) prev_reports[report_id];
+    const uint32_t* relative = report_masks_relative[report_id];
+    const uint32_t* absolute = report_masks_absolute[report_id];
 
-    for (int i = 0; i < report_sizes[report_id]; i++) {
-        if ((report[i] & relative[i]) || ((report[i] & absolute[i]) != (prev_report[i] & absolute[i]))) {
+    for (int i = 0; i < report_words[report_id]; i++) {
+        if ((report[i] & relative[i]) || ((report[i] ^ prev_report[i]) & absolute[i])) {
             return true;
         }
     }
@@ -313,47 +381,51 @@ bool is_expr_valid(uint8_t expr) {
     return true;
 }
 
-void validate_expressions() {
-    for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
-        expression_valid[i] = is_expr_valid(i);
-        if (!expression_valid[i]) {
-            printf("Expression %d invalid.\n", i + 1);
-        }
-    }
+inline uint64_t state_slot_key(uint32_t usage, uint8_t hub_port, bool raw) {
+    return (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
 }
 
-void invalidate_expr_state_ptr_cache() {
-    for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
-        for (auto& elem : expressions[i]) {
-            elem.state_ptr = NULL;
-        }
-    }
+inline uint32_t state_slot_hash(uint64_t key) {
+    return ((uint32_t) (key ^ (key >> 32)) * 0x9E3779B1) >> (32 - STATE_SLOT_INDEX_BITS);
+}
+
+void clear_state_slots() {
+    used_state_slots = 0;
+    memset(state_slot_index, 0, sizeof(state_slot_index));
 }
 
 bool assign_state_slot(uint32_t usage, uint8_t hub_port, bool raw) {
-    uint64_t key = (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
-    if (usage_state_ptr.count(key) == 0) {
-        if (used_state_slots >= MAX_INPUT_STATES) {
-            printf("out of input_state slots!");
-            return false;
+    uint64_t key = state_slot_key(usage, hub_port, raw);
+    uint32_t i = state_slot_hash(key);
+    while (state_slot_index[i] != 0) {
+        if (state_slot_keys[state_slot_index[i] - 1] == key) {
+            return true;
         }
+        i = (i + 1) & (STATE_SLOT_INDEX_SIZE - 1);
+    }
 
-        usage_state_ptr[key] = input_state + used_state_slots++;
+    if (used_state_slots >= MAX_INPUT_STATES) {
+        printf("out of input_state slots!");
+        return false;
     }
+
+    state_slot_keys[used_state_slots] = key;
+    state_slot_index[i] = ++used_state_slots;
     return true;
 }
 
 inline int32_t* get_state_ptr(uint32_t usage, uint8_t hub_port, bool assign_if_absent = false, bool raw = false) {
-    uint64_t key = (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
-    auto search = usage_state_ptr.find(key);
-    if (search != usage_state_ptr.end()) {
-        return search->second;
+    uint64_t key = state_slot_key(usage, hub_port, raw);
+    for (uint32_t i = state_slot_hash(key); state_slot_index[i] != 0; i = (i + 1) & (STATE_SLOT_INDEX_SIZE - 1)) {
+        if (state_slot_keys[state_slot_index[i] - 1] == key) {
+            return input_state + state_slot_index[i] - 1;
+        }
     }
 
     if (assign_if_absent) {
         if (assign_state_slot(usage, hub_port, raw)) {
             their_descriptor_updated = true;
-            return usage_state_ptr[key];  // it's zero, but maybe someone wants to write to it
+            return input_state + used_state_slots - 1;  // it's zero, but maybe someone wants to write to it
         }
     }
 
@@ -378,6 +450,20 @@ inline uint8_t* get_sticky_state_ptr(uint32_t usage, uint8_t hub_port, bool assi
     return NULL;
 }
 
+inline void mark_slot_dirty(uint32_t slot) {
+    dirty_slots[slot / 32] |= 1 << (slot % 32);
+}
+
+inline void update_state(int32_t* state_ptr, int32_t value) {
+    if (*state_ptr != value) {
+        *state_ptr = value;
+        mark_slot_dirty(state_ptr - input_state);
+    }
+}
+
+void compile_expressions();
+void compile_binary_sources();
+
 void set_mapping_from_config() {
     std::unordered_map<uint64_t, std::vector<map_source_t>> reverse_mapping_map;  // hub_port+target -> sources list
     std::unordered_map<uint64_t, uint8_t> sticky_usage_map;
@@ -386,18 +472,18 @@ void set_mapping_from_config() {
     std::unordered_set<uint64_t> tap_hold_usage_set;
     std::unordered_map<uint32_t, uint8_t> mapped_on_layers;  // usage -> layer mask
 
-    validate_expressions();
-    invalidate_expr_state_ptr_cache();
-
     reverse_mapping.clear();
     reverse_mapping_macros.clear();
     reverse_mapping_layers.clear();
-    used_state_slots = 0;
-    usage_state_ptr.clear();
+    // partial scroll state doesn't survive a config change, accumulated movement does
+    mapping_program.source_accumulated_scroll.clear();
+    mapping_program.source_last_scroll_timestamp.clear();
+    clear_state_slots();
     register_ptrs.clear();
     memset(input_state, 0, sizeof(input_state));
     memset(tap_hold_state, 0, sizeof(tap_hold_state));
     memset(sticky_state, 0, sizeof(sticky_state));
+    memset(dirty_slots, 0xFF, sizeof(dirty_slots));
     uint32_t gpio_in_mask_ = 0;
     uint32_t gpio_out_mask_ = 0;
 
@@ -502,6 +588,8 @@ void set_mapping_from_config() {
     }
     my_mutex_exit(MutexId::MACROS);
 
+    compile_expressions();
+
     sticky_usages.clear();
     tap_hold_usages.clear();
     tap_sticky_usages.clear();
@@ -698,15 +786,293 @@ void set_mapping_from_config() {
         }
     }
 
+    compile_binary_sources();
+
     set_gpio_inout_masks(gpio_in_mask_, gpio_out_mask_);
     update_their_descriptor_derivates();
 }
 
-bool differ_on_absolute(const uint8_t* report1, const uint8_t* report2, uint8_t report_id) {
-    uint8_t* absolute = report_masks_absolute[report_id];
+static inline void set_slot_bit(std::vector<uint32_t>& bitset, uint32_t slot) {
+    bitset[slot / 32] |= 1 << (slot % 32);
+}
+
+void compile_binary_sources() {
+    binary_sources_t& b = binary_sources;
+    uint32_t slots = used_state_slots;
+    b.words = (slots + 31) / 32;
+    for (auto bitset : { &b.tap_hold_slots, &b.sticky_slots, &b.tap_sticky_slots, &b.hold_sticky_slots, &b.layer_source_slots,
+             &b.any_source_slots, &b.carried_dirty, &b.tap_hold_settling, &b.tap_hold_waiting, &b.taps, &b.hold_starts }) {
+        bitset->assign(b.words, 0);
+    }
+    for (auto index : { &b.tap_hold_index, &b.sticky_index, &b.tap_sticky_index, &b.hold_sticky_index }) {
+        index->assign(slots, NO_BINARY_SOURCE);
+    }
+
+    for (uint16_t i = 0; i < tap_hold_usages.size(); i++) {
+        uint32_t slot = tap_hold_usages[i].input_state - input_state;
+        set_slot_bit(b.tap_hold_slots, slot);
+        b.tap_hold_index[slot] = i;
+    }
+    for (uint16_t i = 0; i < sticky_usages.size(); i++) {
+        uint32_t slot = sticky_usages[i].input_state - input_state;
+        set_slot_bit(b.sticky_slots, slot);
+        b.sticky_index[slot] = i;
+    }
+    for (uint16_t i = 0; i < tap_sticky_usages.size(); i++) {
+        uint32_t slot = tap_sticky_usages[i].tap_hold_state - tap_hold_state;
+        set_slot_bit(b.tap_sticky_slots, slot);
+        b.tap_sticky_index[slot] = i;
+    }
+    for (uint16_t i = 0; i < hold_sticky_usages.size(); i++) {
+        uint32_t slot = hold_sticky_usages[i].tap_hold_state - tap_hold_state;
+        set_slot_bit(b.hold_sticky_slots, slot);
+        b.hold_sticky_index[slot] = i;
+    }
+    for (auto const& rev_map : reverse_mapping_layers) {
+        for (auto const& map_source : rev_map.sources) {
+            set_slot_bit(b.layer_source_slots, map_source.input_state - input_state);
+        }
+    }
+
+    for (uint32_t word = 0; word < b.words; word++) {
+        b.any_source_slots[word] = b.tap_hold_slots[word] | b.sticky_slots[word] | b.tap_sticky_slots[word] |
+                                   b.hold_sticky_slots[word] | b.layer_source_slots[word];
+    }
+
+    b.tap_hold_deadline = 0;
+    b.layers_dirty = true;
+}
+
+void compile_macro_item(std::vector<bit_writer_t>& writers, uint32_t usage) {
+    if ((usage & 0xFFFF0000) == GPIO_USAGE_PAGE) {
+        writers.push_back((bit_writer_t){
+            .data = gpio_out_state,
+            .len = sizeof(gpio_out_state),
+            .size = 1,
+            .bitpos = (uint16_t) (usage & 0xFFFF),
+            .kernel = BitsKernel::BIT,
+            .max_value = 1,
+        });
+        return;
+    }
+    if ((usage & 0xFFFF0000) == DPAD_USAGE_PAGE) {
+        writers.push_back((bit_writer_t){
+            .data = &dpad_state,
+            .len = sizeof(dpad_state),
+            .size = 1,
+            .bitpos = (uint16_t) ((usage & 0xFFFF) - 1),
+            .kernel = BitsKernel::BIT,
+            .max_value = 1,
+        });
+        return;
+    }
+    for (auto const& array_usage : our_array_range_usages) {
+        if ((usage >= array_usage.usage) && (usage <= array_usage.usage_def.usage_maximum)) {
+            writers.push_back((bit_writer_t){
+                .data = reports[array_usage.usage_def.report_id],
+                .len = report_sizes[array_usage.usage_def.report_id],
+                .size = array_usage.usage_def.size,
+                .bitpos = array_usage.usage_def.bitpos,
+                .kernel = array_usage.usage_def.kernel,
+                .array_count = (uint8_t) array_usage.usage_def.count,
+                .array_index = array_usage.usage_def.logical_minimum + usage - array_usage.usage,
+            });
+            return;
+        }
+    }
+    auto search = our_usages_flat.find(usage);
+    if (search != our_usages_flat.end()) {
+        const usage_def_t& our_usage = search->second;
+        writers.push_back((bit_writer_t){
+            .data = reports[our_usage.report_id],
+            .len = report_sizes[our_usage.report_id],
+            .size = our_usage.size,
+            .bitpos = our_usage.bitpos,
+            .kernel = our_usage.kernel,
+            .max_value = 1,
+        });
+    }
+}
+
+// The layer table's vectors are sized for every source in
+// compile_mapping_program(), so switching layers doesn't allocate.
+void select_layer_table(mapping_program_t& program, uint8_t layer_mask) {
+    layer_table_t& table = program.layer_table;
+    table.sources.clear();
+    for (uint32_t t = 0; t < program.target_usage.size(); t++) {
+        uint32_t sources_begin = (t > 0) ? program.target_sources_end[t - 1] : 0;
+        for (uint32_t s = sources_begin; s < program.target_sources_end[t]; s++) {
+            if ((program.source_op[s] == SourceOp::STICKY) || (program.source_layer_mask[s] & layer_mask)) {
+                table.sources.push_back(s);
+            }
+        }
+        table.target_sources_end[t] = table.sources.size();
+    }
+}
+
+void compile_mapping_program() {
+    mapping_program_t program;
+    std::unordered_map<uint32_t, uint16_t> accumulator_index;  // target usage -> accumulator
+
+    for (auto const& rev_map : reverse_mapping) {
+        TargetOp target_op;
+        if (rev_map.is_relative) {
+            target_op = ((rev_map.target == V_SCROLL_USAGE) || (rev_map.target == H_SCROLL_USAGE)) ? TargetOp::SCROLL : TargetOp::RELATIVE;
+        } else {
+            target_op = ((rev_map.target & 0xFFFF0000) == REGISTER_USAGE_PAGE) ? TargetOp::REGISTER : TargetOp::ABSOLUTE;
+        }
+
+        for (auto const& map_source : rev_map.sources) {
+            bool scaled = ((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
+                          ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE);
+            SourceOp op;
+            int32_t param = map_source.scaling;
+            if (rev_map.is_relative) {
+                if (map_source.sticky) {
+                    op = SourceOp::STICKY;
+                } else if (map_source.hold) {
+                    op = SourceOp::TAP_HOLD;
+                    param = scaled ? param / 1000 : param;
+                } else if (map_source.is_binary) {
+                    op = SourceOp::BINARY;
+                    param = scaled ? param / 1000 : param;
+                } else {
+                    op = scaled ? SourceOp::VALUE_SCALED : SourceOp::VALUE;
+                }
+            } else {
+                // for sources that are either on or off we know up front what they add to the target
+                if (map_source.sticky) {
+                    op = SourceOp::STICKY;
+                    param = map_source.scaling / 1000 - rev_map.default_value;
+                } else if (map_source.tap || map_source.hold) {
+                    op = SourceOp::TAP_HOLD;
+                    param = map_source.scaling / 1000 - rev_map.default_value;
+                } else if (map_source.is_relative && (target_op != TargetOp::REGISTER)) {
+                    op = SourceOp::RELATIVE_AS_BINARY;
+                } else if (map_source.is_binary) {
+                    op = SourceOp::BINARY;
+                    param = (scaled ? map_source.scaling / 1000 / 1000 : map_source.scaling / 1000) - rev_map.default_value;
+                } else {
+                    op = scaled ? SourceOp::VALUE_SCALED : SourceOp::VALUE;
+                }
+            }
+
+            program.source_op.push_back(op);
+            program.source_flags.push_back(
+                (map_source.tap ? SOURCE_FLAG_TAP : 0) |
+                (map_source.hold ? SOURCE_FLAG_HOLD : 0) |
+                (map_source.is_relative ? SOURCE_FLAG_RELATIVE : 0));
+            program.source_layer_mask.push_back(map_source.layer_mask);
+            program.source_port_mask.push_back((map_source.orig_source_port != 0) ? (1 << map_source.orig_source_port) : 0);
+            program.source_slot.push_back(map_source.input_state - input_state);
+            program.source_param.push_back(param);
+        }
+
+        if ((target_op == TargetOp::ABSOLUTE) || (target_op == TargetOp::REGISTER)) {
+            for (auto const& out_usage_def : rev_map.our_usages) {
+                program.writers.push_back((bit_writer_t){
+                    .data = out_usage_def.data,
+                    .len = out_usage_def.len,
+                    .size = out_usage_def.size,
+                    .bitpos = out_usage_def.bitpos,
+                    .kernel = bits_kernel(out_usage_def.bitpos, out_usage_def.size),
+                    .array_count = out_usage_def.array_count,
+                    .array_index = out_usage_def.array_index,
+                    .max_value = (out_usage_def.size < 32) ? (1u << out_usage_def.size) - 1 : 0xFFFFFFFF,
+                });
+            }
+        }
+
+        uint16_t accumulator = 0;
+        if ((target_op == TargetOp::RELATIVE) || (target_op == TargetOp::SCROLL)) {
+            auto [it, inserted] = accumulator_index.try_emplace(rev_map.target, program.accumulator_usage.size());
+            if (inserted) {
+                auto search = our_usages_flat.find(rev_map.target);
+                program.accumulator_usage.push_back(rev_map.target);
+                program.accumulator_field.push_back((search != our_usages_flat.end()) ? search->second : (usage_def_t){});
+                program.accumulator_value.push_back(0);
+            }
+            accumulator = it->second;
+        }
+
+        program.target_usage.push_back(rev_map.target);
+        program.target_op.push_back(target_op);
+        program.target_accumulator.push_back(accumulator);
+        program.target_default_value.push_back(rev_map.default_value);
+        program.target_sources_end.push_back(program.source_op.size());
+        program.target_writers_end.push_back(program.writers.size());
+    }
+
+    uint32_t ntargets = program.target_usage.size();
+    program.target_dirty.assign((ntargets + 31) / 32, 0xFFFFFFFF);
+    program.target_value.assign(ntargets, 0);
+    program.auto_repeat_targets.assign((ntargets + 31) / 32, 0);
+    for (uint32_t t = 0; t < ntargets; t++) {
+        if ((program.target_op[t] != TargetOp::RELATIVE) && (program.target_op[t] != TargetOp::SCROLL)) {
+            continue;
+        }
+        uint32_t sources_begin = (t > 0) ? program.target_sources_end[t - 1] : 0;
+        for (uint32_t s = sources_begin; s < program.target_sources_end[t]; s++) {
+            if (!(program.source_flags[s] & SOURCE_FLAG_RELATIVE)) {
+                program.auto_repeat_targets[t / 32] |= 1 << (t % 32);
+                break;
+            }
+        }
+    }
+
+    program.slot_targets_end.assign(used_state_slots, 0);
+    for (uint16_t slot : program.source_slot) {
+        program.slot_targets_end[slot]++;
+    }
+    for (uint32_t slot = 1; slot < used_state_slots; slot++) {
+        program.slot_targets_end[slot] += program.slot_targets_end[slot - 1];
+    }
+    std::vector<uint16_t> slot_fill = program.slot_targets_end;
+    program.slot_targets.resize(program.source_slot.size());
+    for (uint32_t t = ntargets; t-- > 0;) {
+        uint32_t sources_begin = (t > 0) ? program.target_sources_end[t - 1] : 0;
+        for (uint32_t s = sources_begin; s < program.target_sources_end[t]; s++) {
+            program.slot_targets[--slot_fill[program.source_slot[s]]] = t;
+        }
+    }
+
+    // this gets called again when devices come and go, partial scroll state survives that
+    program.source_accumulated_scroll.swap(mapping_program.source_accumulated_scroll);
+    program.source_last_scroll_timestamp.swap(mapping_program.source_last_scroll_timestamp);
+    program.source_accumulated_scroll.resize(program.source_op.size());
+    program.source_last_scroll_timestamp.resize(program.source_op.size());
+    program.macro_steps_end.resize(NMACROS);
+    my_mutex_enter(MutexId::MACROS);
+    for (int macro = 0; macro < NMACROS; macro++) {
+        for (auto const& usages : macros[macro]) {
+            for (uint32_t usage : usages) {
+                compile_macro_item(program.macro_writers, usage);
+            }
+            program.macro_step_writers_end.push_back(program.macro_writers.size());
+        }
+        program.macro_steps_end[macro] = program.macro_step_writers_end.size();
+    }
+    my_mutex_exit(MutexId::MACROS);
+
+    for (uint32_t i = 0; i < mapping_program.accumulator_usage.size(); i++) {
+        auto search = accumulator_index.find(mapping_program.accumulator_usage[i]);
+        if (search != accumulator_index.end()) {
+            program.accumulator_value[search->second] = mapping_program.accumulator_value[i];
+        }
+    }
+
+    mapping_program = std::move(program);
+
+    mapping_program.layer_table.sources.reserve(mapping_program.source_op.size());
+    mapping_program.layer_table.target_sources_end.resize(mapping_program.target_usage.size());
+    select_layer_table(mapping_program, layer_state_mask);
+}
+
+bool differ_on_absolute(const uint32_t* report1, const uint32_t* report2, uint8_t report_id) {
+    const uint32_t* absolute = report_masks_absolute[report_id];
 
-    for (int i = 0; i < report_sizes[report_id]; i++) {
-        if ((report1[i] & absolute[i]) != (report2[i] & absolute[i])) {
+    for (int i = 0; i < report_words[report_id]; i++) {
+        if ((report1[i] ^ report2[i]) & absolute[i]) {
             return true;
         }
     }
@@ -714,27 +1080,179 @@ bool differ_on_absolute(const uint8_t* report1, const uint8_t* report2, uint8_t
     return false;
 }
 
-void aggregate_relative(uint8_t* prev_report, const uint8_t* report, uint8_t report_id) {
-    for (auto const& [usage, usage_def] : our_usages[report_id]) {
-        if (usage_def.is_relative) {
-            int32_t val1 = get_bits(report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
+void aggregate_relative(uint32_t* prev_report, const uint32_t* report, uint8_t report_id) {
+    const uint32_t* relative = report_masks_relative[report_id];
+    uint32_t moved = 0;
+    for (int i = 0; i < report_words[report_id]; i++) {
+        moved |= report[i] & relative[i];
+    }
+    if (!moved) {
+        return;
+    }
+
+    for (auto const& usage_def : our_relative_usages[report_id]) {
+        int32_t val1 = get_bits(usage_def.kernel, (const uint8_t*) report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
+        if (usage_def.logical_minimum < 0) {
+            if (val1 & (1 << (usage_def.size - 1))) {
+                val1 |= 0xFFFFFFFF << usage_def.size;
+            }
+        }
+        if (val1) {
+            int32_t val2 = get_bits(usage_def.kernel, (const uint8_t*) prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
             if (usage_def.logical_minimum < 0) {
-                if (val1 & (1 << (usage_def.size - 1))) {
-                    val1 |= 0xFFFFFFFF << usage_def.size;
+                if (val2 & (1 << (usage_def.size - 1))) {
+                    val2 |= 0xFFFFFFFF << usage_def.size;
                 }
             }
-            if (val1) {
-                int32_t val2 = get_bits(prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
-                if (usage_def.logical_minimum < 0) {
-                    if (val2 & (1 << (usage_def.size - 1))) {
-                        val2 |= 0xFFFFFFFF << usage_def.size;
-                    }
-                }
 
-                put_bits(prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size, val1 + val2);
-            }
+            put_bits(usage_def.kernel, (uint8_t*) prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size, val1 + val2);
+        }
+    }
+}
+
+// True if some absolute bit changes going into state and changes back
+// coming out of it, so dropping state would lose a press or a release.
+bool carries_edge(const uint32_t* before, const uint32_t* state, const uint32_t* after, uint8_t report_id) {
+    const uint32_t* absolute = report_masks_absolute[report_id];
+
+    for (int i = 0; i < report_words[report_id]; i++) {
+        if ((before[i] ^ state[i]) & (state[i] ^ after[i]) & absolute[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Makes room in a full queue by folding a queued state that doesn't carry
+// an edge into the one after it. The oldest entry is left alone, we don't
+// know what the host saw before it.
+bool fold_queued_state(uint8_t report_id, uint64_t& input_time) {
+    uint8_t items = or_items[report_id];
+    for (int k = items - 1; k >= 1; k--) {
+        uint32_t* after = (k == items - 1) ? (uint32_t*) reports[report_id] : outgoing_report(report_id, k + 1) + 1;
+        if (carries_edge(outgoing_report(report_id, k - 1) + 1, outgoing_report(report_id, k) + 1, after, report_id)) {
+            continue;
+        }
+        aggregate_relative(after, outgoing_report(report_id, k) + 1, report_id);
+        uint64_t folded_input_time = outgoing_report_meta(report_id, k).input_time;
+        for (int j = k; j < items - 1; j++) {
+            memcpy(outgoing_report(report_id, j), outgoing_report(report_id, j + 1), (report_words[report_id] + 1) * 4);
+            outgoing_report_meta(report_id, j) = outgoing_report_meta(report_id, j + 1);
+        }
+        uint64_t& after_input_time = (k == items - 1) ? input_time : outgoing_report_meta(report_id, k).input_time;
+        if (folded_input_time != 0) {
+            after_input_time = folded_input_time;
+        }
+        or_items[report_id]--;
+        or_total_items--;
+        return true;
+    }
+    return false;
+}
+
+// Appends reports[report_id] to the queue at idx.
+void put_outgoing_report(uint8_t report_id, uint8_t idx, uint64_t input_time) {
+    uint32_t* entry = outgoing_report(report_id, idx);
+    outgoing_report_with_id(entry)[0] = report_id;
+    memcpy(entry + 1, reports[report_id], report_words[report_id] * 4);
+    memcpy(prev_reports[report_id], reports[report_id], report_sizes[report_id]);
+    outgoing_report_meta(report_id, idx) = (outgoing_report_meta_t){
+        .seq = or_next_seq++,
+        .input_time = input_time,
+        .queued_time = get_time(),
+    };
+}
+
+// Moves the waiting state into the queue once there's room for it.
+void promote_pending_report(uint8_t report_id) {
+    if (or_pending[report_id] && (or_items[report_id] < outgoing_queue_depth)) {
+        or_pending[report_id] = false;
+        or_items[report_id]++;
+        or_total_items++;
+    }
+}
+
+// A full queue with nothing left to fold: the new state waits in the slot
+// after the queue. If that's taken, the waiting state is replaced unless it
+// carries an edge. Otherwise the new state can't go anywhere, its relative
+// values are added to the waiting one and false is returned. The caller
+// clears the report, but refresh_next_frame makes the next frame compute
+// the absolute state from the inputs again and it's retried then.
+bool queue_pending_report(uint8_t report_id, uint64_t input_time) {
+    uint8_t items = or_items[report_id];
+    if (!or_pending[report_id]) {
+        put_outgoing_report(report_id, items, input_time);
+        or_pending[report_id] = true;
+        return true;
+    }
+    uint32_t* pending = outgoing_report(report_id, items) + 1;
+    outgoing_report_meta_t& pending_meta = outgoing_report_meta(report_id, items);
+    if (!differ_on_absolute(pending, (uint32_t*) reports[report_id], report_id)) {
+        aggregate_relative(pending, (uint32_t*) reports[report_id], report_id);
+        if (pending_meta.input_time == 0) {
+            pending_meta.input_time = input_time;
+        }
+        reports_merged++;
+        return true;
+    }
+    if (!carries_edge(outgoing_report(report_id, items - 1) + 1, pending, (uint32_t*) reports[report_id], report_id)) {
+        aggregate_relative((uint32_t*) reports[report_id], pending, report_id);
+        memcpy(pending, reports[report_id], report_words[report_id] * 4);
+        memcpy(prev_reports[report_id], reports[report_id], report_sizes[report_id]);
+        if (pending_meta.input_time == 0) {
+            pending_meta.input_time = input_time;
+        }
+        reports_merged++;
+        return true;
+    }
+    aggregate_relative(pending, (uint32_t*) reports[report_id], report_id);
+    reports_dropped++;
+    refresh_next_frame = true;
+    return false;
+}
+
+// Returns false if the report couldn't be queued, see queue_pending_report().
+bool queue_outgoing_report(uint8_t report_id, uint64_t input_time) {
+    if (!needs_to_be_sent(report_id)) {
+        return true;
+    }
+    // the depth can be raised while a state is waiting
+    promote_pending_report(report_id);
+    if (or_pending[report_id]) {
+        return queue_pending_report(report_id, input_time);
+    }
+    uint8_t items = or_items[report_id];
+    if ((items > 0) &&
+        !differ_on_absolute(outgoing_report(report_id, items - 1) + 1, (uint32_t*) reports[report_id], report_id)) {
+        aggregate_relative(outgoing_report(report_id, items - 1) + 1, (uint32_t*) reports[report_id], report_id);
+        if (outgoing_report_meta(report_id, items - 1).input_time == 0) {
+            outgoing_report_meta(report_id, items - 1).input_time = input_time;
+        }
+        reports_merged++;
+        return true;
+    }
+    // the depth can be lowered while a queue holds more than that
+    if (items >= outgoing_queue_depth) {
+        if (outgoing_queue_keep_latest) {
+            // replace the newest queued state
+            uint32_t* entry = outgoing_report(report_id, items - 1);
+            aggregate_relative((uint32_t*) reports[report_id], entry + 1, report_id);
+            memcpy(entry + 1, reports[report_id], report_words[report_id] * 4);
+            memcpy(prev_reports[report_id], reports[report_id], report_sizes[report_id]);
+            reports_dropped++;
+            return true;
         }
+        if (!fold_queued_state(report_id, input_time)) {
+            return queue_pending_report(report_id, input_time);
+        }
+        reports_merged++;
+        items--;
     }
+    put_outgoing_report(report_id, items, input_time);
+    or_items[report_id]++;
+    or_total_items++;
+    return true;
 }
 
 static uint8_t dpad_table[16] = { 8, 6, 2, 8, 0, 7, 1, 0, 4, 5, 3, 4, 8, 6, 2, 8 };
@@ -744,17 +1262,85 @@ static inline uint8_t dpad(bool left, bool right, bool up, bool down) {
     return dpad_table[index];
 }
 
-int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
+static inline int32_t expr_sin(int32_t angle) {
+#if FIXED_POINT_MATH
+    return fixed_sin(angle);
+#else
+    return sinf((float) angle * 3.14159265f / 180000.0f) * 1000;
+#endif
+}
+
+static inline int32_t expr_cos(int32_t angle) {
+#if FIXED_POINT_MATH
+    return fixed_cos(angle);
+#else
+    return cosf((float) angle * 3.14159265f / 180000.0f) * 1000;
+#endif
+}
+
+static inline int32_t expr_atan2(int32_t y, int32_t x) {
+#if FIXED_POINT_MATH
+    return fixed_atan2(y, x);
+#else
+    return atan2(y, x) * 57295.779513;  // result in degrees
+#endif
+}
+
+static inline int32_t expr_sqrt(int32_t value) {
+#if FIXED_POINT_MATH
+    return fixed_sqrt(value);
+#else
+    return sqrt(value) * 31.622776601683793;
+#endif
+}
+
+static inline int32_t expr_fp32(const int32_t* state_ptr) {
+#if FIXED_POINT_MATH
+    return fixed_from_fp32(*(const uint32_t*) state_ptr);
+#else
+    return 1000.0f * *((const float*) state_ptr);
+#endif
+}
+
+static inline void deadzone(int32_t& x_value, int32_t& y_value, int32_t inner_deadzone_radius, int32_t outer_deadzone) {
+    int32_t x = x_value / 1000 - 128;
+    int32_t y = y_value / 1000 - 128;
+#if FIXED_POINT_MATH
+    int32_t radius = isqrt32((x * x) + (y * y));
+#else
+    int32_t radius = sqrt((x * x) + (y * y));
+#endif
+    if ((radius < inner_deadzone_radius) || (radius * (128 - inner_deadzone_radius - outer_deadzone) <= 0)) {
+        x_value = 128000;
+        y_value = 128000;
+    } else {
+        x_value = 128 + x * 128 * (radius - inner_deadzone_radius) / (radius * (128 - inner_deadzone_radius - outer_deadzone));
+        if (x_value < 0) {
+            x_value = 0;
+        }
+        if (x_value > 255) {
+            x_value = 255;
+        }
+        x_value *= 1000;
+        y_value = 128 + y * 128 * (radius - inner_deadzone_radius) / (radius * (128 - inner_deadzone_radius - outer_deadzone));
+        if (y_value < 0) {
+            y_value = 0;
+        }
+        if (y_value > 255) {
+            y_value = 255;
+        }
+        y_value *= 1000;
+    }
+}
+
+// Stack depth was checked by is_expr_valid() when the code was compiled.
+template <bool debuggable>
+int32_t run_expr(expr_elem_t* code, uint16_t len, uint8_t expr, uint64_t now, bool auto_repeat) {
     static int32_t stack[STACK_SIZE];
     bool debug = false;
     int16_t ptr = -1;
-    if (expr >= NEXPRESSIONS) {
-        return 0;
-    }
-    if (!expression_valid[expr]) {
-        return 0;
-    }
-    for (auto& elem : expressions[expr]) {
+    for (expr_elem_t* elem_ptr = code; elem_ptr < code + len; elem_ptr++) {
+        expr_elem_t& elem = *elem_ptr;
         switch (elem.op) {
             case Op::PUSH:
             case Op::PUSH_USAGE:
@@ -806,10 +1392,10 @@ int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
                 ptr++;
                 break;
             case Op::SIN:
-                stack[ptr] = sinf((float) stack[ptr] * 3.14159265f / 180000.0f) * 1000;
+                stack[ptr] = expr_sin(stack[ptr]);
                 break;
             case Op::COS:
-                stack[ptr] = cosf((float) stack[ptr] * 3.14159265f / 180000.0f) * 1000;
+                stack[ptr] = expr_cos(stack[ptr]);
                 break;
             case Op::DEBUG:
                 debug = true;
@@ -902,11 +1488,11 @@ int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
             }
             case Op::SQRT:
                 if (stack[ptr] >= 0) {
-                    stack[ptr] = sqrt(stack[ptr]) * 31.622776601683793;
+                    stack[ptr] = expr_sqrt(stack[ptr]);
                 }
                 break;
             case Op::ATAN2:
-                stack[ptr - 1] = atan2(stack[ptr - 1], stack[ptr]) * 57295.779513;  // result in degrees
+                stack[ptr - 1] = expr_atan2(stack[ptr - 1], stack[ptr]);
                 ptr--;
                 break;
             case Op::ROUND:
@@ -930,13 +1516,13 @@ int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
                 if (elem.state_ptr == NULL) {
                     elem.state_ptr = get_state_ptr(stack[ptr], port_register, true, true);
                 }
-                stack[ptr] = (elem.state_ptr != NULL) ? 1000.0f * *((float*) elem.state_ptr) : 0;
+                stack[ptr] = (elem.state_ptr != NULL) ? expr_fp32(elem.state_ptr) : 0;
                 break;
             case Op::PREV_INPUT_STATE_FP32:
                 if (elem.state_ptr == NULL) {
                     elem.state_ptr = get_state_ptr(stack[ptr], port_register, true, true);
                 }
-                stack[ptr] = (elem.state_ptr != NULL) ? 1000.0f * *((float*) elem.state_ptr + PREV_STATE_OFFSET) : 0;
+                stack[ptr] = (elem.state_ptr != NULL) ? expr_fp32(elem.state_ptr + PREV_STATE_OFFSET) : 0;
                 break;
             case Op::MIN:
                 stack[ptr - 1] = stack[ptr - 1] < stack[ptr] ? stack[ptr - 1] : stack[ptr];
@@ -1010,70 +1596,72 @@ int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
                 }
                 stack[ptr] = (elem.state_ptr != NULL) ? *(elem.state_ptr + PREV_STATE_OFFSET) * 1000 : 0;
                 break;
-            case Op::DEADZONE: {
-                int32_t x = stack[ptr - 2] / 1000 - 128;
-                int32_t y = stack[ptr - 1] / 1000 - 128;
-                int32_t radius = sqrt((x * x) + (y * y));
-                int32_t deadzone_radius = stack[ptr] / 1000;
-                if ((radius < deadzone_radius) || (radius * (128 - deadzone_radius) <= 0)) {
-                    stack[ptr - 2] = 128000;
-                    stack[ptr - 1] = 128000;
-                } else {
-                    stack[ptr - 2] = 128 + x * 128 * (radius - deadzone_radius) / (radius * (128 - deadzone_radius));
-                    if (stack[ptr - 2] < 0) {
-                        stack[ptr - 2] = 0;
-                    }
-                    if (stack[ptr - 2] > 255) {
-                        stack[ptr - 2] = 255;
-                    }
-                    stack[ptr - 2] *= 1000;
-                    stack[ptr - 1] = 128 + y * 128 * (radius - deadzone_radius) / (radius * (128 - deadzone_radius));
-                    if (stack[ptr - 1] < 0) {
-                        stack[ptr - 1] = 0;
-                    }
-                    if (stack[ptr - 1] > 255) {
-                        stack[ptr - 1] = 255;
-                    }
-                    stack[ptr - 1] *= 1000;
-                }
+            case Op::DEADZONE:
+                deadzone(stack[ptr - 2], stack[ptr - 1], stack[ptr] / 1000, 0);
                 ptr--;
                 break;
-            }
-            case Op::DEADZONE2: {
-                int32_t x = stack[ptr - 3] / 1000 - 128;
-                int32_t y = stack[ptr - 2] / 1000 - 128;
-                int32_t radius = sqrt((x * x) + (y * y));
-                int32_t inner_deadzone_radius = stack[ptr - 1] / 1000;
-                int32_t outer_deadzone = stack[ptr] / 1000;
-                if ((radius < inner_deadzone_radius) || (radius * (128 - inner_deadzone_radius - outer_deadzone) <= 0)) {
-                    stack[ptr - 3] = 128000;
-                    stack[ptr - 2] = 128000;
-                } else {
-                    stack[ptr - 3] = 128 + x * 128 * (radius - inner_deadzone_radius) / (radius * (128 - inner_deadzone_radius - outer_deadzone));
-                    if (stack[ptr - 3] < 0) {
-                        stack[ptr - 3] = 0;
-                    }
-                    if (stack[ptr - 3] > 255) {
-                        stack[ptr - 3] = 255;
-                    }
-                    stack[ptr - 3] *= 1000;
-                    stack[ptr - 2] = 128 + y * 128 * (radius - inner_deadzone_radius) / (radius * (128 - inner_deadzone_radius - outer_deadzone));
-                    if (stack[ptr - 2] < 0) {
-                        stack[ptr - 2] = 0;
-                    }
-                    if (stack[ptr - 2] > 255) {
-                        stack[ptr - 2] = 255;
-                    }
-                    stack[ptr - 2] *= 1000;
-                }
+            case Op::DEADZONE2:
+                deadzone(stack[ptr - 3], stack[ptr - 2], stack[ptr - 1] / 1000, stack[ptr] / 1000);
                 ptr -= 2;
                 break;
-            }
+            case Op::LOAD_INPUT_STATE:
+            case Op::LOAD_INPUT_STATE_SCALED:
+                stack[++ptr] = *elem.state_ptr * 1000;
+                break;
+            case Op::LOAD_INPUT_STATE_BINARY:
+                stack[++ptr] = !!(*elem.state_ptr) * 1000;
+                break;
+            case Op::LOAD_INPUT_STATE_FP32:
+                stack[++ptr] = expr_fp32(elem.state_ptr);
+                break;
+            case Op::LOAD_PREV_INPUT_STATE:
+            case Op::LOAD_PREV_INPUT_STATE_SCALED:
+                stack[++ptr] = *(elem.state_ptr + PREV_STATE_OFFSET) * 1000;
+                break;
+            case Op::LOAD_PREV_INPUT_STATE_BINARY:
+                stack[++ptr] = !!(*(elem.state_ptr + PREV_STATE_OFFSET)) * 1000;
+                break;
+            case Op::LOAD_PREV_INPUT_STATE_FP32:
+                stack[++ptr] = expr_fp32(elem.state_ptr + PREV_STATE_OFFSET);
+                break;
+            case Op::LOAD_STICKY_STATE:
+                stack[++ptr] = *elem.sticky_state_ptr;
+                break;
+            case Op::LOAD_TAP_STATE:
+                stack[++ptr] = elem.tap_hold_state_ptr->tap * 1000;
+                break;
+            case Op::LOAD_HOLD_STATE:
+                stack[++ptr] = elem.tap_hold_state_ptr->hold * 1000;
+                break;
+            case Op::ADD_CONST:
+                stack[ptr] = stack[ptr] + (int32_t) elem.val;
+                break;
+            case Op::SUB_CONST:
+                stack[ptr] = stack[ptr] - (int32_t) elem.val;
+                break;
+            case Op::MUL_CONST:
+                stack[ptr] = (int64_t) stack[ptr] * (int32_t) elem.val / 1000;
+                break;
+            case Op::DIV_CONST:
+                stack[ptr] = (int64_t) 1000 * stack[ptr] / (int32_t) elem.val;
+                break;
+            case Op::EQ_CONST:
+                stack[ptr] = (stack[ptr] == (int32_t) elem.val) * 1000;
+                break;
+            case Op::GT_CONST:
+                stack[ptr] = (stack[ptr] > (int32_t) elem.val) * 1000;
+                break;
+            case Op::LT_CONST:
+                stack[ptr] = (stack[ptr] < (int32_t) elem.val) * 1000;
+                break;
+            case Op::DEADZONE_CONST:
+                deadzone(stack[ptr - 1], stack[ptr], elem.val, 0);
+                break;
             default:
                 printf("unknown op!\n");
                 return 0;
         }
-        if (debug) {
+        if (debuggable && debug) {
             for (int i = 0; i <= ptr; i++) {
                 printf("0x%08lx ", stack[i]);
             }
@@ -1086,98 +1674,689 @@ int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
     return 0;
 }
 
-void process_mapping(bool auto_repeat) {
-    if (suspended) {
-        return;
+static inline bool is_const(const std::vector<expr_elem_t>& code, uint8_t n) {
+    if (code.size() < n) {
+        return false;
     }
-
-    uint64_t now = get_time();
-    frame_counter++;
-
-    for (auto& tap_hold : tap_hold_usages) {
-        if ((*tap_hold.input_state != 0) && (*(tap_hold.input_state + PREV_STATE_OFFSET) == 0)) {
-            tap_hold.pressed_at = now;
+    for (auto it = code.end() - n; it != code.end(); it++) {
+        if ((it->op != Op::PUSH) && (it->op != Op::PUSH_USAGE)) {
+            return false;
         }
-        tap_hold.tap_hold_state->tap =
-            (*tap_hold.input_state == 0) && (*(tap_hold.input_state + PREV_STATE_OFFSET) != 0) &&
-            (now - tap_hold.pressed_at < tap_hold_threshold);
-        tap_hold.tap_hold_state->prev_hold = tap_hold.tap_hold_state->hold;
-        tap_hold.tap_hold_state->hold =
-            (*tap_hold.input_state != 0) &&
-            (now - tap_hold.pressed_at >= tap_hold_threshold);
     }
+    return true;
+}
 
-    for (auto const& sticky : sticky_usages) {
-        if ((layer_state_mask & sticky.layer_mask) &&
-            ((*(sticky.input_state + PREV_STATE_OFFSET) == 0) && (*sticky.input_state != 0))) {
-            *sticky.sticky_state ^= (layer_state_mask & sticky.layer_mask);
-        }
+// How many inputs op takes if it only depends on them, 0 if it can't be folded.
+static uint8_t foldable_inputs(Op op, const std::vector<expr_elem_t>& code) {
+    switch (op) {
+        case Op::NOT:
+        case Op::ABS:
+        case Op::SIN:
+        case Op::COS:
+        case Op::RELU:
+        case Op::BITWISE_NOT:
+        case Op::SQRT:
+        case Op::ROUND:
+        case Op::SIGN:
+            return 1;
+        case Op::ADD:
+        case Op::MUL:
+        case Op::EQ:
+        case Op::GT:
+        case Op::BITWISE_OR:
+        case Op::BITWISE_AND:
+        case Op::ATAN2:
+        case Op::MIN:
+        case Op::MAX:
+        case Op::DIV:
+        case Op::SUB:
+        case Op::LT:
+            return 2;
+        case Op::MOD:
+            // leave division by zero to happen at runtime like it always did
+            if (is_const(code, 1) && ((int32_t) code.back().val != 0) && ((int32_t) code.back().val != -1)) {
+                return 2;
+            }
+            return 0;
+        case Op::CLAMP:
+        case Op::IFTE:
+            return 3;
+        case Op::DPAD:
+            return 4;
+        default:
+            return 0;
     }
+}
 
-    for (auto& tap_sticky : tap_sticky_usages) {
-        if ((layer_state_mask & tap_sticky.layer_mask) && tap_sticky.tap_hold_state->tap) {
-            *tap_sticky.sticky_state ^= (layer_state_mask & tap_sticky.layer_mask);
-        }
+static Op const_variant(Op op) {
+    switch (op) {
+        case Op::ADD:
+            return Op::ADD_CONST;
+        case Op::SUB:
+            return Op::SUB_CONST;
+        case Op::MUL:
+            return Op::MUL_CONST;
+        case Op::DIV:
+            return Op::DIV_CONST;
+        case Op::EQ:
+            return Op::EQ_CONST;
+        case Op::GT:
+            return Op::GT_CONST;
+        case Op::LT:
+            return Op::LT_CONST;
+        default:
+            return op;
     }
+}
 
-    for (auto& hold_sticky : hold_sticky_usages) {
-        if ((layer_state_mask & hold_sticky.layer_mask) &&
-            hold_sticky.tap_hold_state->hold && !hold_sticky.tap_hold_state->prev_hold) {
-            *hold_sticky.sticky_state ^= (layer_state_mask & hold_sticky.layer_mask);
-        }
+// Turns a state op whose usage is known into a load from a slot assigned now.
+static bool compile_load(Op op, uint32_t usage, uint8_t hub_port, expr_elem_t& load) {
+    load.val = usage;
+    switch (op) {
+        case Op::INPUT_STATE:
+            load.op = Op::LOAD_INPUT_STATE;
+            load.state_ptr = get_state_ptr(usage, hub_port, true, true);
+            return load.state_ptr != NULL;
+        case Op::INPUT_STATE_BINARY:
+            load.op = Op::LOAD_INPUT_STATE_BINARY;
+            load.state_ptr = get_state_ptr(usage, hub_port, true);
+            return load.state_ptr != NULL;
+        case Op::INPUT_STATE_SCALED:
+            load.op = Op::LOAD_INPUT_STATE_SCALED;
+            load.state_ptr = get_state_ptr(usage, hub_port, true);
+            return load.state_ptr != NULL;
+        case Op::INPUT_STATE_FP32:
+            load.op = Op::LOAD_INPUT_STATE_FP32;
+            load.state_ptr = get_state_ptr(usage, hub_port, true, true);
+            return load.state_ptr != NULL;
+        case Op::PREV_INPUT_STATE:
+            load.op = Op::LOAD_PREV_INPUT_STATE;
+            load.state_ptr = get_state_ptr(usage, hub_port, true, true);
+            return load.state_ptr != NULL;
+        case Op::PREV_INPUT_STATE_BINARY:
+            load.op = Op::LOAD_PREV_INPUT_STATE_BINARY;
+            load.state_ptr = get_state_ptr(usage, hub_port, true);
+            return load.state_ptr != NULL;
+        case Op::PREV_INPUT_STATE_SCALED:
+            load.op = Op::LOAD_PREV_INPUT_STATE_SCALED;
+            load.state_ptr = get_state_ptr(usage, hub_port, true);
+            return load.state_ptr != NULL;
+        case Op::PREV_INPUT_STATE_FP32:
+            load.op = Op::LOAD_PREV_INPUT_STATE_FP32;
+            load.state_ptr = get_state_ptr(usage, hub_port, true, true);
+            return load.state_ptr != NULL;
+        case Op::STICKY_STATE:
+            load.op = Op::LOAD_STICKY_STATE;
+            load.sticky_state_ptr = get_sticky_state_ptr(usage, hub_port, true);
+            return load.sticky_state_ptr != NULL;
+        case Op::TAP_STATE:
+            load.op = Op::LOAD_TAP_STATE;
+            load.tap_hold_state_ptr = get_tap_hold_state_ptr(usage, hub_port, true);
+            return load.tap_hold_state_ptr != NULL;
+        case Op::HOLD_STATE:
+            load.op = Op::LOAD_HOLD_STATE;
+            load.tap_hold_state_ptr = get_tap_hold_state_ptr(usage, hub_port, true);
+            return load.tap_hold_state_ptr != NULL;
+        default:
+            return false;
     }
+}
 
-    uint8_t new_layer_state_mask = 0;
-    for (auto const& rev_map : reverse_mapping_layers) {
-        uint16_t i = rev_map.target & 0xFFFF;
-        for (auto const& map_source : rev_map.sources) {
-            if (!map_source.sticky) {
-                if ((map_source.layer_mask & layer_state_mask) &&
-                    (map_source.hold
-                            ? map_source.tap_hold_state->hold
-                            : *map_source.input_state)) {
-                    new_layer_state_mask |= 1 << i;
-                }
-            } else {  // is sticky
-                // This part is responsible for deactivating a layer if it was activated
-                // by a sticky mapping and the user pressed the button again.
-                // There must be a better way of handling this.
-                if (((!map_source.tap && !map_source.hold && (*(map_source.input_state + PREV_STATE_OFFSET) == 0) && (*map_source.input_state != 0)) ||
-                        (map_source.tap && map_source.tap_hold_state->tap) ||
-                        (map_source.hold && map_source.tap_hold_state->hold && !map_source.tap_hold_state->prev_hold)) &&
-                    (*map_source.sticky_state & map_source.layer_mask) &&
-                    (layer_state_mask & (1 << i))) {
-                    *map_source.sticky_state &= ~map_source.layer_mask;
+// Works out what an expression's result depends on so that it only needs
+// to be evaluated again when one of those values changes.
+static void schedule_expression(uint8_t expr) {
+    expr_schedule_t& schedule = expression_schedule[expr];
+    const std::vector<expr_elem_t>& code = compiled_expressions[expr];
+    schedule.always = false;
+    schedule.side_effects = false;
+    schedule.evaluated = false;
+    schedule.inputs.clear();
+    for (size_t i = 0; i < code.size(); i++) {
+        const expr_elem_t& elem = code[i];
+        switch (elem.op) {
+            case Op::LOAD_INPUT_STATE:
+            case Op::LOAD_INPUT_STATE_BINARY:
+            case Op::LOAD_INPUT_STATE_SCALED:
+            case Op::LOAD_INPUT_STATE_FP32:
+                schedule.inputs.push_back((expr_input_t){ .ptr = elem.state_ptr, .byte = false });
+                break;
+            case Op::LOAD_PREV_INPUT_STATE:
+            case Op::LOAD_PREV_INPUT_STATE_BINARY:
+            case Op::LOAD_PREV_INPUT_STATE_SCALED:
+            case Op::LOAD_PREV_INPUT_STATE_FP32:
+                schedule.inputs.push_back((expr_input_t){ .ptr = elem.state_ptr + PREV_STATE_OFFSET, .byte = false });
+                break;
+            case Op::LOAD_STICKY_STATE:
+                schedule.inputs.push_back((expr_input_t){ .ptr = elem.sticky_state_ptr, .byte = true });
+                break;
+            case Op::LOAD_TAP_STATE:
+            case Op::LOAD_HOLD_STATE:
+                schedule.inputs.push_back((expr_input_t){ .ptr = elem.tap_hold_state_ptr, .byte = true });
+                break;
+            case Op::LAYER_STATE:
+                schedule.inputs.push_back((expr_input_t){ .ptr = &layer_state_mask, .byte = true });
+                break;
+            case Op::RECALL:
+                if ((i > 0) && (code[i - 1].op == Op::PUSH)) {
+                    int32_t reg_number = (int32_t) code[i - 1].val / 1000 - 1;
+                    if ((reg_number >= 0) && (reg_number < NREGISTERS)) {
+                        schedule.inputs.push_back((expr_input_t){ .ptr = &registers[reg_number], .byte = false });
+                    }
+                } else {
+                    schedule.always = true;
                 }
+                break;
+            // time and things we look up by usage at runtime
+            case Op::TIME:
+            case Op::TIME_SEC:
+            case Op::AUTO_REPEAT:
+            case Op::PLUGGED_IN:
+            case Op::INPUT_STATE:
+            case Op::INPUT_STATE_BINARY:
+            case Op::INPUT_STATE_SCALED:
+            case Op::INPUT_STATE_FP32:
+            case Op::PREV_INPUT_STATE:
+            case Op::PREV_INPUT_STATE_BINARY:
+            case Op::PREV_INPUT_STATE_SCALED:
+            case Op::PREV_INPUT_STATE_FP32:
+            case Op::STICKY_STATE:
+            case Op::TAP_STATE:
+            case Op::HOLD_STATE:
+                schedule.always = true;
+                break;
+            case Op::STORE:
+            case Op::MONITOR:
+            case Op::PRINT_IF:
+            case Op::PORT:
+            case Op::DEBUG:
+                schedule.always = true;
+                schedule.side_effects = true;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Expression results only go somewhere if something reads them, which
+// means they have a state slot.
+static void update_expression_results() {
+    for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
+        expression_schedule[i].result = get_state_ptr(EXPR_USAGE_PAGE | (i + 1), 0);
+    }
+    expression_result_slots = used_state_slots;
+}
+
+static inline bool expression_inputs_changed(std::vector<expr_input_t>& inputs) {
+    bool changed = false;
+    for (auto& input : inputs) {
+        int32_t value = input.byte ? *(const uint8_t*) input.ptr : *(const int32_t*) input.ptr;
+        if (value != input.value) {
+            input.value = value;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Expressions are evaluated in order every frame with port_register starting
+// at 0, so as long as PORT is only given constants we know which port each
+// state op will read and can assign its slot here instead of on first use.
+// Whatever we can't resolve keeps the lazy lookup in run_expr().
+void compile_expressions() {
+    int16_t port = 0;  // -1 once it depends on runtime values
+
+    my_mutex_enter(MutexId::EXPRESSIONS);
+    for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
+        std::vector<expr_elem_t>& code = compiled_expressions[i];
+        code.clear();
+        expression_valid[i] = is_expr_valid(i);
+        expression_debug[i] = false;
+        if (!expression_valid[i]) {
+            printf("Expression %d invalid.\n", i + 1);
+            continue;
+        }
+        for (auto const& elem : expressions[i]) {
+            if (elem.op == Op::DEBUG) {
+                expression_debug[i] = true;
+            }
+        }
+
+        for (auto const& elem : expressions[i]) {
+            if (elem.op == Op::PORT) {
+                if (is_const(code, 1)) {
+                    uint8_t new_port = (int32_t) code.back().val / 1000;
+                    port = (new_port > NPORTS) ? 0 : new_port;
+                } else {
+                    port = -1;
+                }
+            }
+
+            // debug output shows the stack after every op, so keep them as they are
+            if (expression_debug[i]) {
+                code.push_back((expr_elem_t){ .op = elem.op, .val = elem.val });
+                continue;
+            }
+
+            switch (elem.op) {
+                case Op::EOL:
+                    break;
+                case Op::PUSH:
+                case Op::PUSH_USAGE:
+                    code.push_back((expr_elem_t){ .op = Op::PUSH, .val = elem.val });
+                    break;
+                case Op::SCALING:
+                    code.push_back((expr_elem_t){ .op = Op::PUSH, .val = 1000 });
+                    break;
+                case Op::DUP:
+                    code.push_back(is_const(code, 1) ? code.back() : (expr_elem_t){ .op = Op::DUP });
+                    break;
+                case Op::DEADZONE:
+                    if (is_const(code, 1)) {
+                        code.back() = (expr_elem_t){ .op = Op::DEADZONE_CONST, .val = (uint32_t) ((int32_t) code.back().val / 1000) };
+                    } else {
+                        code.push_back((expr_elem_t){ .op = Op::DEADZONE });
+                    }
+                    break;
+                default: {
+                    expr_elem_t load;
+                    if ((port >= 0) && is_const(code, 1) && compile_load(elem.op, code.back().val, port, load)) {
+                        code.back() = load;
+                        break;
+                    }
 
-                // Sticky mapping works even if it's not present on the currently active layers.
-                if (*map_source.sticky_state & map_source.layer_mask) {
-                    new_layer_state_mask |= 1 << i;
+                    uint8_t n = foldable_inputs(elem.op, code);
+                    if ((n > 0) && is_const(code, n)) {
+                        expr_elem_t tmp[5];
+                        std::copy(code.end() - n, code.end(), tmp);
+                        tmp[n] = (expr_elem_t){ .op = elem.op };
+                        code.resize(code.size() - n);
+                        code.push_back((expr_elem_t){ .op = Op::PUSH, .val = (uint32_t) run_expr<false>(tmp, n + 1, i, 0, false) });
+                        break;
+                    }
+
+                    Op const_op = const_variant(elem.op);
+                    if ((const_op != elem.op) && is_const(code, 1) &&
+                        !((const_op == Op::DIV_CONST) && (code.back().val == 0))) {
+                        code.back() = (expr_elem_t){ .op = const_op, .val = code.back().val };
+                        break;
+                    }
+
+                    code.push_back((expr_elem_t){ .op = elem.op, .val = elem.val });
+                    break;
                 }
             }
         }
     }
+    my_mutex_exit(MutexId::EXPRESSIONS);
+
+    for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
+        schedule_expression(i);
+    }
+    update_expression_results();
+}
+
+int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat) {
+    if (expr >= NEXPRESSIONS) {
+        return 0;
+    }
+    if (!expression_valid[expr]) {
+        return 0;
+    }
+    std::vector<expr_elem_t>& code = compiled_expressions[expr];
+    if (expression_debug[expr]) {
+        return run_expr<true>(code.data(), code.size(), expr, now, auto_repeat);
+    }
+    return run_expr<false>(code.data(), code.size(), expr, now, auto_repeat);
+}
 
-    // if no layer is active then layer 0 is active
-    if (new_layer_state_mask == 0) {
-        new_layer_state_mask = 1;
+inline void clear_relative_usages() {
+    for (auto state : relative_usages) {
+        update_state(state, 0);
     }
+}
+
+inline uint16_t macro_steps_begin(uint8_t macro) {
+    return (macro > 0) ? mapping_program.macro_steps_end[macro - 1] : 0;
+}
 
-    layer_state_mask = new_layer_state_mask;
+inline void write_bits(const bit_writer_t& writer, uint32_t value) {
+    if (writer.array_count == 0) {
+        if (value > writer.max_value) {
+            value = writer.max_value;
+        }
+        put_bits(writer.kernel, writer.data, writer.len, writer.bitpos, writer.size, value);
+    } else {  // array range
+        for (int i = 0; i < writer.array_count; i++) {
+            int32_t existing_val = get_bits(writer.kernel, writer.data, writer.len, writer.bitpos + i * writer.size, writer.size);
+            // theoretically zero could be a valid index, but let's ignore that for now
+            if (existing_val == 0) {
+                put_bits(writer.kernel, writer.data, writer.len, writer.bitpos + i * writer.size, writer.size, writer.array_index);
+                break;
+            }
+        }
+        // we don't do RollOver
+    }
+}
 
-    // evaluate all expressions
+// Returns true if some relative target moved, those have to be evaluated again next frame.
+inline bool execute_mapping_program(uint64_t now, bool auto_repeat) {
+    mapping_program_t& p = mapping_program;
+    const layer_table_t& layer_table = p.layer_table;
+    bool moving = false;
+
+    // sources that aren't on the active layers aren't in layer_table
+    for (uint32_t t = 0; t < p.target_usage.size(); t++) {
+        const uint32_t sources_end = layer_table.target_sources_end[t];
+        const uint32_t writers_end = p.target_writers_end[t];
+        const int32_t default_value = p.target_default_value[t];
+        const bool dirty = p.target_dirty[t / 32] & (1 << (t % 32));
+        uint32_t i = (t > 0) ? layer_table.target_sources_end[t - 1] : 0;
+        uint32_t w = (t > 0) ? p.target_writers_end[t - 1] : 0;
+
+        switch (p.target_op[t]) {
+            case TargetOp::RELATIVE:
+            case TargetOp::SCROLL: {
+                if (!dirty && !p.target_value[t]) {
+                    break;
+                }
+                int32_t sum = 0;
+                bool moved = false;
+                for (; i < sources_end; i++) {
+                    const uint32_t s = layer_table.sources[i];
+                    if ((p.source_port_mask[s] & ~active_ports_mask) ||
+                        !(auto_repeat || (p.source_flags[s] & SOURCE_FLAG_RELATIVE))) {
+                        continue;
+                    }
+                    const uint16_t slot = p.source_slot[s];
+                    int32_t value = 0;
+                    switch (p.source_op[s]) {
+                        case SourceOp::STICKY:
+                            value = !!(sticky_state[slot] & p.source_layer_mask[s]) * p.source_param[s];
+                            break;
+                        case SourceOp::TAP_HOLD:
+                            value = tap_hold_state[slot].hold ? p.source_param[s] : 0;
+                            break;
+                        case SourceOp::BINARY:
+                            value = input_state[slot] ? p.source_param[s] : 0;
+                            break;
+                        case SourceOp::VALUE:
+                            value = input_state[slot] * p.source_param[s];
+                            break;
+                        case SourceOp::VALUE_SCALED:
+                            value = input_state[slot] * p.source_param[s] / 1000;
+                            break;
+                        default:
+                            break;
+                    }
+                    if (value != 0) {
+                        moved = true;
+                        if (p.target_op[t] == TargetOp::SCROLL) {
+                            sum += handle_scroll(p.source_accumulated_scroll[s], p.source_last_scroll_timestamp[s], p.target_usage[t], value * RESOLUTION_MULTIPLIER, now);
+                        } else {
+                            sum += value;
+                        }
+                    }
+                }
+                if (sum != 0) {
+                    p.accumulator_value[p.target_accumulator[t]] += sum;
+                }
+                p.target_value[t] = moved;
+                moving |= moved;
+                break;
+            }
+            case TargetOp::ABSOLUTE:
+            case TargetOp::REGISTER: {
+                const bool register_target = p.target_op[t] == TargetOp::REGISTER;
+                if (dirty) {
+                    int32_t value = default_value;
+                    for (; i < sources_end; i++) {
+                        const uint32_t s = layer_table.sources[i];
+                        if (p.source_port_mask[s] & ~active_ports_mask) {
+                            continue;
+                        }
+                        const uint16_t slot = p.source_slot[s];
+                        switch (p.source_op[s]) {
+                            case SourceOp::STICKY:
+                                if (sticky_state[slot] & p.source_layer_mask[s]) {
+                                    value += p.source_param[s];
+                                }
+                                break;
+                            case SourceOp::TAP_HOLD:
+                                if (((p.source_flags[s] & SOURCE_FLAG_TAP) && tap_hold_state[slot].tap) ||
+                                    ((p.source_flags[s] & SOURCE_FLAG_HOLD) && tap_hold_state[slot].hold)) {
+                                    value += p.source_param[s];
+                                }
+                                break;
+                            case SourceOp::RELATIVE_AS_BINARY:
+                                if (input_state[slot] * p.source_param[s] > 0) {
+                                    value += 1;
+                                }
+                                break;
+                            case SourceOp::BINARY:
+                                if (input_state[slot]) {
+                                    value += p.source_param[s];
+                                }
+                                break;
+                            case SourceOp::VALUE:
+                                value += (int32_t) ((int64_t) input_state[slot] * p.source_param[s] / 1000) - default_value;
+                                break;
+                            case SourceOp::VALUE_SCALED:
+                                value += (int32_t) ((int64_t) input_state[slot] * p.source_param[s] / 1000) / 1000 - default_value;
+                                break;
+                        }
+                    }
+
+                    if (register_target) {
+                        value *= 1000;
+                    } else if (value < 0) {
+                        // we don't currently have any absolute usages that can be negative
+                        value = 0;
+                    }
+                    p.target_value[t] = value;
+                }
+
+                const int32_t value = p.target_value[t];
+                if ((value != default_value) || register_target) {
+                    for (; w < writers_end; w++) {
+                        write_bits(p.writers[w], value);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    std::fill(p.target_dirty.begin(), p.target_dirty.end(), 0);
+
+    return moving;
+}
+
+void process_mapping(bool auto_repeat) {
+    if (suspended) {
+        return;
+    }
+
+    uint64_t now = get_time();
+    uint64_t input_time = first_unprocessed_report_time;
+    first_unprocessed_report_time = 0;
+    if (input_time != 0) {
+        record_latency(LatencyStage::INPUT_TO_PROCESSING, now - input_time);
+    }
+    // runs between ticks (immediate processing) don't count as frames
+    if (auto_repeat) {
+        frame_counter++;
+    }
+
+    // Only sources whose input_state slot is dirty can have an edge. Tap-hold
+    // sources also need a look the frame after they change and when a pressed
+    // one may have been held long enough.
+    binary_sources_t& b = binary_sources;
+    const bool check_waiting = now >= b.tap_hold_deadline;
+    uint64_t tap_hold_deadline = check_waiting ? UINT64_MAX : b.tap_hold_deadline;
+    for (uint32_t word = 0; word < b.words; word++) {
+        uint32_t evaluate = ((dirty_slots[word] | b.carried_dirty[word]) & b.tap_hold_slots[word]) | b.tap_hold_settling[word];
+        if (check_waiting) {
+            evaluate |= b.tap_hold_waiting[word];
+        }
+        b.tap_hold_settling[word] = 0;
+        b.taps[word] = 0;
+        b.hold_starts[word] = 0;
+        while (evaluate) {
+            uint32_t bit = __builtin_ctz(evaluate);
+            evaluate &= evaluate - 1;
+            tap_hold_usage_t& tap_hold = tap_hold_usages[b.tap_hold_index[word * 32 + bit]];
+            if ((*tap_hold.input_state != 0) && (*(tap_hold.input_state + PREV_STATE_OFFSET) == 0)) {
+                tap_hold.pressed_at = now;
+            }
+            const bool tap =
+                (*tap_hold.input_state == 0) && (*(tap_hold.input_state + PREV_STATE_OFFSET) != 0) &&
+                (now - tap_hold.pressed_at < tap_hold_threshold);
+            const bool hold =
+                (*tap_hold.input_state != 0) &&
+                (now - tap_hold.pressed_at >= tap_hold_threshold);
+            if ((tap != tap_hold.tap_hold_state->tap) || (hold != tap_hold.tap_hold_state->hold)) {
+                mark_slot_dirty(tap_hold.tap_hold_state - tap_hold_state);
+            }
+            tap_hold.tap_hold_state->tap = tap;
+            tap_hold.tap_hold_state->prev_hold = tap_hold.tap_hold_state->hold;
+            tap_hold.tap_hold_state->hold = hold;
+
+            if (tap || (hold != tap_hold.tap_hold_state->prev_hold)) {
+                b.tap_hold_settling[word] |= 1 << bit;
+            }
+            if (tap) {
+                b.taps[word] |= 1 << bit;
+            }
+            if (hold && !tap_hold.tap_hold_state->prev_hold) {
+                b.hold_starts[word] |= 1 << bit;
+            }
+            if ((*tap_hold.input_state != 0) && !hold) {
+                b.tap_hold_waiting[word] |= 1 << bit;
+                if (tap_hold.pressed_at + tap_hold_threshold < tap_hold_deadline) {
+                    tap_hold_deadline = tap_hold.pressed_at + tap_hold_threshold;
+                }
+            } else {
+                b.tap_hold_waiting[word] &= ~(1 << bit);
+            }
+        }
+    }
+    b.tap_hold_deadline = tap_hold_deadline;
+
+    for (uint32_t word = 0; word < b.words; word++) {
+        uint32_t candidates = (dirty_slots[word] | b.carried_dirty[word]) & b.sticky_slots[word];
+        while (candidates) {
+            uint32_t slot = word * 32 + __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            const sticky_usage_t& sticky = sticky_usages[b.sticky_index[slot]];
+            if ((layer_state_mask & sticky.layer_mask) &&
+                ((*(sticky.input_state + PREV_STATE_OFFSET) == 0) && (*sticky.input_state != 0))) {
+                *sticky.sticky_state ^= (layer_state_mask & sticky.layer_mask);
+                mark_slot_dirty(sticky.sticky_state - sticky_state);
+            }
+        }
+
+        candidates = b.taps[word] & b.tap_sticky_slots[word];
+        while (candidates) {
+            uint32_t slot = word * 32 + __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            const tap_hold_sticky_usage_t& tap_sticky = tap_sticky_usages[b.tap_sticky_index[slot]];
+            if (layer_state_mask & tap_sticky.layer_mask) {
+                *tap_sticky.sticky_state ^= (layer_state_mask & tap_sticky.layer_mask);
+                mark_slot_dirty(tap_sticky.sticky_state - sticky_state);
+            }
+        }
+
+        candidates = b.hold_starts[word] & b.hold_sticky_slots[word];
+        while (candidates) {
+            uint32_t slot = word * 32 + __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            const tap_hold_sticky_usage_t& hold_sticky = hold_sticky_usages[b.hold_sticky_index[slot]];
+            if (layer_state_mask & hold_sticky.layer_mask) {
+                *hold_sticky.sticky_state ^= (layer_state_mask & hold_sticky.layer_mask);
+                mark_slot_dirty(hold_sticky.sticky_state - sticky_state);
+            }
+        }
+    }
+
+    // The layers only have to be computed again if one of their sources (or
+    // its tap-hold or sticky state) changed, or if the layer state did.
+    bool layers_dirty = b.layers_dirty || (layer_state_mask != b.layers_computed_for);
+    for (uint32_t word = 0; (word < b.words) && !layers_dirty; word++) {
+        layers_dirty = ((dirty_slots[word] | b.carried_dirty[word]) & b.layer_source_slots[word]) != 0;
+    }
+    if (layers_dirty) {
+        b.layers_dirty = false;
+        b.layers_computed_for = layer_state_mask;
+
+        uint8_t new_layer_state_mask = 0;
+        for (auto const& rev_map : reverse_mapping_layers) {
+            uint16_t i = rev_map.target & 0xFFFF;
+            for (auto const& map_source : rev_map.sources) {
+                if (!map_source.sticky) {
+                    if ((map_source.layer_mask & layer_state_mask) &&
+                        (map_source.hold
+                                ? map_source.tap_hold_state->hold
+                                : *map_source.input_state)) {
+                        new_layer_state_mask |= 1 << i;
+                    }
+                } else {  // is sticky
+                    // This part is responsible for deactivating a layer if it was activated
+                    // by a sticky mapping and the user pressed the button again.
+                    // There must be a better way of handling this.
+                    if (((!map_source.tap && !map_source.hold && (*(map_source.input_state + PREV_STATE_OFFSET) == 0) && (*map_source.input_state != 0)) ||
+                            (map_source.tap && map_source.tap_hold_state->tap) ||
+                            (map_source.hold && map_source.tap_hold_state->hold && !map_source.tap_hold_state->prev_hold)) &&
+                        (*map_source.sticky_state & map_source.layer_mask) &&
+                        (layer_state_mask & (1 << i))) {
+                        *map_source.sticky_state &= ~map_source.layer_mask;
+                        mark_slot_dirty(map_source.sticky_state - sticky_state);
+                    }
+
+                    // Sticky mapping works even if it's not present on the currently active layers.
+                    if (*map_source.sticky_state & map_source.layer_mask) {
+                        new_layer_state_mask |= 1 << i;
+                    }
+                }
+            }
+        }
+
+        // if no layer is active then layer 0 is active
+        if (new_layer_state_mask == 0) {
+            new_layer_state_mask = 1;
+        }
+
+        layer_state_mask = new_layer_state_mask;
+    }
+
+    // evaluate expressions that are used and whose inputs changed
     // XXX should we do this before or after tap-hold/sticky/layer logic?
     port_register = 0;
+    expression_frames++;
     for (uint8_t i = 0; i < NEXPRESSIONS; i++) {
+        // an expression can look up a usage we haven't seen before, that can be another expression
+        if (expression_result_slots != used_state_slots) {
+            update_expression_results();
+        }
+        expr_schedule_t& schedule = expression_schedule[i];
+        if ((schedule.result == NULL) && !schedule.side_effects) {
+            continue;
+        }
+        if (!schedule.always) {
+            if (!expression_inputs_changed(schedule.inputs) && schedule.evaluated) {
+                continue;
+            }
+            schedule.evaluated = true;
+        }
+        expression_evaluations[i]++;
         int32_t result = eval_expr(i, frame_counter, auto_repeat);
-        int32_t* state_ptr = get_state_ptr(EXPR_USAGE_PAGE | (i + 1), 0);
-        if (state_ptr != NULL) {
-            *state_ptr = result;
+        if (schedule.result != NULL) {
+            update_state(schedule.result, result);
         }
     }
 
     for (auto const& reg_ptr : register_ptrs) {
-        *reg_ptr.state_ptr = *reg_ptr.register_ptr;
+        update_state(reg_ptr.state_ptr, *reg_ptr.register_ptr);
     }
 
     // queue triggered macros
@@ -1191,16 +2370,74 @@ void process_mapping(bool auto_repeat) {
                 ((!map_source.tap && !map_source.hold && (*(map_source.input_state + PREV_STATE_OFFSET) == 0) && (*map_source.input_state != 0)) ||
                     (map_source.hold && map_source.tap_hold_state->hold && !map_source.tap_hold_state->prev_hold) ||
                     (map_source.tap && map_source.tap_hold_state->tap))) {
-                my_mutex_enter(MutexId::MACROS);
-                for (auto const& usages : macros[macro]) {
-                    macro_queue.push((macro_entry_t){ duration_left : macro_entry_duration, items : usages });
+                if (macro_steps_begin(macro) == mapping_program.macro_steps_end[macro]) {
+                    continue;
+                }
+                if (macro_queue_items == MACRO_QUEUE_SIZE) {
+                    printf("macro queue full!\n");
+                    continue;
                 }
-                my_mutex_exit(MutexId::MACROS);
+                macro_queue[(macro_queue_head + macro_queue_items) % MACRO_QUEUE_SIZE] = (macro_cursor_t){
+                    .macro = (uint8_t) macro,
+                    .duration = macro_entry_duration,
+                    .duration_left = macro_entry_duration,
+                    .step = 0,
+                };
+                macro_queue_items++;
             }
         }
     }
 
-    memcpy(input_state + PREV_STATE_OFFSET, input_state, used_state_slots * sizeof(input_state[0]));
+    mapping_program_t& p = mapping_program;
+    if ((layer_state_mask != mapped_layer_state_mask) ||
+        (active_ports_mask != mapped_active_ports_mask)) {
+        std::fill(p.target_dirty.begin(), p.target_dirty.end(), 0xFFFFFFFF);
+        if (layer_state_mask != mapped_layer_state_mask) {
+            select_layer_table(p, layer_state_mask);
+        }
+        mapped_layer_state_mask = layer_state_mask;
+        mapped_active_ports_mask = active_ports_mask;
+    }
+    // immediate frames alternate with ticks, only some relative targets care
+    if (auto_repeat != mapped_auto_repeat) {
+        for (uint32_t word = 0; word < p.target_dirty.size(); word++) {
+            p.target_dirty[word] |= p.auto_repeat_targets[word];
+        }
+        mapped_auto_repeat = auto_repeat;
+    }
+
+    // only slots that changed need their previous state updated and their targets reevaluated
+    bool targets_dirty = false;
+    for (uint32_t word = 0; word < (used_state_slots + 31) / 32; word++) {
+        if (word < b.words) {
+            b.carried_dirty[word] = dirty_slots[word] & b.any_source_slots[word];
+        }
+        while (dirty_slots[word]) {
+            uint32_t slot = word * 32 + __builtin_ctz(dirty_slots[word]);
+            dirty_slots[word] &= dirty_slots[word] - 1;
+            input_state[PREV_STATE_OFFSET + slot] = input_state[slot];
+            if (slot < p.slot_targets_end.size()) {
+                for (uint32_t i = (slot > 0) ? p.slot_targets_end[slot - 1] : 0; i < p.slot_targets_end[slot]; i++) {
+                    uint16_t t = p.slot_targets[i];
+                    p.target_dirty[t / 32] |= 1 << (t % 32);
+                }
+            }
+        }
+    }
+    for (uint32_t word : p.target_dirty) {
+        targets_dirty |= word != 0;
+    }
+
+    // nothing changed since the last frame, the reports we'd produce would be the same
+    if (!targets_dirty && !refresh_next_frame && (macro_queue_items == 0)) {
+        // not a PROCESSING sample, the histogram is for frames that got mapped
+        clear_relative_usages();
+        processing_time += get_time() - now;
+        return;
+    }
+    refresh_next_frame = false;
+
+    memset(gpio_out_state, 0, sizeof(gpio_out_state));
     digipot_state[0] = 128;
     digipot_state[1] = 128;
     digipot_state[2] = 128;
@@ -1209,175 +2446,50 @@ void process_mapping(bool auto_repeat) {
     digipot_state[5] = 0;
     dpad_state = 0;
 
-    for (auto& rev_map : reverse_mapping) {
-        uint32_t target = rev_map.target;
-        bool register_target = (target & 0xFFFF0000) == REGISTER_USAGE_PAGE;
-        if (rev_map.is_relative) {
-            for (auto& map_source : rev_map.sources) {
-                if ((map_source.orig_source_port != 0) &&
-                    !(active_ports_mask & (1 << map_source.orig_source_port))) {
-                    continue;
-                }
-                int32_t value = 0;
-                if (auto_repeat || map_source.is_relative) {
-                    if (map_source.sticky) {
-                        value = !!(*map_source.sticky_state & map_source.layer_mask) * map_source.scaling;
-                    } else {
-                        if (layer_state_mask & map_source.layer_mask) {
-                            value = map_source.hold ? map_source.tap_hold_state->hold : *map_source.input_state;
-                            if (map_source.is_binary) {
-                                value = !!value;
-                            }
-                            value *= map_source.scaling;
-                            if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
-                                ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
-                                value /= 1000;
-                            }
-                        }
-                    }
-                }
-                if (value != 0) {
-                    if (target == V_SCROLL_USAGE || target == H_SCROLL_USAGE) {
-                        accumulated[target] += handle_scroll(map_source, target, value * RESOLUTION_MULTIPLIER, now);
-                    } else {
-                        accumulated[target] += value;
-                    }
-                }
-            }
-        } else {  // our_usage is absolute
-            int32_t value = rev_map.default_value;
-            for (auto const& map_source : rev_map.sources) {
-                if ((map_source.orig_source_port != 0) &&
-                    !(active_ports_mask & (1 << map_source.orig_source_port))) {
-                    continue;
-                }
-                if (map_source.sticky) {
-                    if (*map_source.sticky_state & map_source.layer_mask) {
-                        value += 1 * map_source.scaling / 1000 - rev_map.default_value;
-                    }
-                } else {
-                    if ((layer_state_mask & map_source.layer_mask)) {
-                        if ((map_source.tap && map_source.tap_hold_state->tap) ||
-                            (map_source.hold && map_source.tap_hold_state->hold)) {
-                            value += 1 * map_source.scaling / 1000 - rev_map.default_value;
-                        }
-                        if (!map_source.tap && !map_source.hold) {
-                            if (map_source.is_relative && !register_target) {
-                                if (*map_source.input_state * map_source.scaling > 0) {
-                                    value += 1;
-                                }
-                            } else {
-                                if ((*map_source.input_state != 0) || (rev_map.default_value != 0)) {
-                                    int32_t candidate = *map_source.input_state;
-                                    if (map_source.is_binary) {
-                                        candidate = !!candidate;
-                                    }
-                                    if ((candidate != 0) || !map_source.is_binary) {
-                                        candidate = (int64_t) candidate * map_source.scaling / 1000;
-                                        if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
-                                            ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
-                                            candidate /= 1000;
-                                        }
-                                        if (candidate != rev_map.default_value) {
-                                            value += candidate - rev_map.default_value;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            // we don't currently have any absolute usages that can be negative
-            if ((value < 0) && !register_target) {
-                value = 0;
-            }
-            if (register_target) {
-                value *= 1000;
-            }
-            if ((value != rev_map.default_value) || register_target) {
-                for (auto const& out_usage_def : rev_map.our_usages) {
-                    if (out_usage_def.array_count == 0) {
-                        uint32_t effective_value = value;
-                        if ((out_usage_def.size < 32) && (effective_value > ((1 << out_usage_def.size) - 1))) {
-                            effective_value = (1 << out_usage_def.size) - 1;
-                        }
-                        put_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos, out_usage_def.size, effective_value);
-                    } else {  // array range
-                        for (int i = 0; i < out_usage_def.array_count; i++) {
-                            int32_t existing_val = get_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos + i * out_usage_def.size, out_usage_def.size);
-                            // theoretically zero could be a valid index, but let's ignore that for now
-                            if (existing_val == 0) {
-                                put_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos + i * out_usage_def.size, out_usage_def.size, out_usage_def.array_index);
-                                break;
-                            }
-                        }
-                        // we don't do RollOver
-                    }
-                }
-            }
-        }
-    }
+    refresh_next_frame = execute_mapping_program(now, auto_repeat);
 
     // execute queued macros
-    if (!macro_queue.empty()) {
-        for (uint32_t usage : macro_queue.front().items) {
-            if ((usage & 0xFFFF0000) == GPIO_USAGE_PAGE) {
-                put_bits(gpio_out_state, sizeof(gpio_out_state), (uint16_t) (usage & 0xFFFF), 1, 1);
-            } else if ((usage & 0xFFFF0000) == DPAD_USAGE_PAGE) {
-                put_bits(&dpad_state, sizeof(dpad_state), (uint16_t) (usage & 0xFFFF) - 1, 1, 1);
-            } else {
-                bool handled = false;
-                for (auto const& array_usage : our_array_range_usages) {
-                    if ((usage >= array_usage.usage) && (usage <= array_usage.usage_def.usage_maximum)) {
-                        const uint8_t report_id = array_usage.usage_def.report_id;
-                        for (unsigned int i = 0; i < array_usage.usage_def.count; i++) {
-                            int32_t existing_val = get_bits(reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size);
-                            // theoretically zero could be a valid index, but let's ignore that for now
-                            if (existing_val == 0) {
-                                put_bits(reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size, array_usage.usage_def.logical_minimum + usage - array_usage.usage);
-                                break;
-                            }
-                        }
-                        // we don't do RollOver
-                        handled = true;
-                        break;
-                    }
-                }
-                if (!handled) {
-                    auto search = our_usages_flat.find(usage);
-                    if (search != our_usages_flat.end()) {
-                        const usage_def_t& our_usage = search->second;
-                        put_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, 1);
-                    }
+    if (macro_queue_items > 0) {
+        refresh_next_frame = true;
+        const mapping_program_t& p = mapping_program;
+        macro_cursor_t& cursor = macro_queue[macro_queue_head];
+        uint32_t step = macro_steps_begin(cursor.macro) + cursor.step;
+        if (step < p.macro_steps_end[cursor.macro]) {
+            for (uint32_t w = (step > 0) ? p.macro_step_writers_end[step - 1] : 0; w < p.macro_step_writers_end[step]; w++) {
+                write_bits(p.macro_writers[w], 1);
+            }
+            // macro timing is in frames
+            if (auto_repeat) {
+                if (cursor.duration_left > 0) {
+                    cursor.duration_left--;
+                } else if (or_total_items == 0) {
+                    cursor.step++;
+                    cursor.duration_left = cursor.duration;
                 }
             }
         }
-        if (macro_queue.front().duration_left > 0) {
-            macro_queue.front().duration_left--;
-        } else {
-            if (or_items == 0) {
-                macro_queue.pop();
-            }
+        // the macro may have changed since it was queued
+        if (macro_steps_begin(cursor.macro) + cursor.step >= p.macro_steps_end[cursor.macro]) {
+            macro_queue_head = (macro_queue_head + 1) % MACRO_QUEUE_SIZE;
+            macro_queue_items--;
         }
     }
 
     if (have_dpad) {
         uint8_t dpad_val = dpad_table[dpad_state];
-        put_bits(reports[our_dpad_usage.report_id], report_sizes[our_dpad_usage.report_id], our_dpad_usage.bitpos, our_dpad_usage.size, dpad_val);
+        put_bits(our_dpad_usage.kernel, reports[our_dpad_usage.report_id], report_sizes[our_dpad_usage.report_id], our_dpad_usage.bitpos, our_dpad_usage.size, dpad_val);
     }
 
-    for (auto state : relative_usages) {
-        *state = 0;
-    }
+    clear_relative_usages();
 
-    for (auto& [usage, accumulated_val] : accumulated) {
+    for (uint32_t i = 0; i < mapping_program.accumulator_value.size(); i++) {
+        int32_t& accumulated_val = mapping_program.accumulator_value[i];
         if (accumulated_val == 0) {
             continue;
         }
-        usage_def_t& our_usage = our_usages_flat[usage];
+        const usage_def_t& our_usage = mapping_program.accumulator_field[i];
         // XXX I don't think this is necessary now that we only do process_mapping once per frame (existing_val is always zero)
-        int32_t existing_val = get_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size);
+        int32_t existing_val = get_bits(our_usage.kernel, (uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size);
         if (our_usage.logical_minimum < 0) {
             if (existing_val & (1 << (our_usage.size - 1))) {
                 existing_val |= 0xFFFFFFFF << our_usage.size;
@@ -1386,31 +2498,25 @@ void process_mapping(bool auto_repeat) {
         int32_t truncated = accumulated_val / 1000;
         accumulated_val -= truncated * 1000;
         if (truncated != 0) {
-            put_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, existing_val + truncated);
+            put_bits(our_usage.kernel, (uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, existing_val + truncated);
         }
     }
 
+    // the passthrough device's reports were queued as they came in, except a held one
+    bool passthrough = active_decode_tables.load(std::memory_order_relaxed)->passthrough_interface != NO_PASSTHROUGH;
+
     for (unsigned int i = 0; i < report_ids.size(); i++) {  // XXX what order should we go in? maybe keyboard first so that mappings to ctrl-left click work as expected?
         uint8_t report_id = report_ids[i];
-        if (our_descriptor->sanitize_report != nullptr) {
+        if ((our_descriptor->sanitize_report != nullptr) && !passthrough) {
             our_descriptor->sanitize_report(report_id, reports[report_id], report_sizes[report_id]);
         }
-        if (needs_to_be_sent(report_id)) {
-            if (or_items == OR_BUFSIZE) {
-                printf("overflow!\n");
-                break;
-            }
-            uint8_t prev = (or_tail + OR_BUFSIZE - 1) % OR_BUFSIZE;
-            if ((or_items > 0) &&
-                (outgoing_reports[prev][0] == report_id) &&
-                !differ_on_absolute(outgoing_reports[prev] + 1, reports[report_id], report_id)) {
-                aggregate_relative(outgoing_reports[prev] + 1, reports[report_id], report_id);
-            } else {
-                outgoing_reports[or_tail][0] = report_id;
-                memcpy(outgoing_reports[or_tail] + 1, reports[report_id], report_sizes[report_id]);
-                memcpy(prev_reports[report_id], reports[report_id], report_sizes[report_id]);
-                or_tail = (or_tail + 1) % OR_BUFSIZE;
-                or_items++;
+        if (!passthrough) {
+            queue_outgoing_report(report_id, input_time);
+            held_passthrough_mask &= ~(1 << report_id);
+        } else if (held_passthrough_mask & (1 << report_id)) {
+            memcpy(reports[report_id], held_passthrough_reports[report_id], report_sizes[report_id]);
+            if (queue_outgoing_report(report_id, held_passthrough_input_time[report_id])) {
+                held_passthrough_mask &= ~(1 << report_id);
             }
         }
         if (our_descriptor->clear_report != nullptr) {
@@ -1429,30 +2535,65 @@ void process_mapping(bool auto_repeat) {
         memset(report, 0, out_report_sizes[interface_report_id]);
     }
 
-    processing_time += get_time() - now;
+    uint64_t duration = get_time() - now;
+    processing_time += duration;
+    record_latency(LatencyStage::PROCESSING, duration);
 }
 
 bool send_report(send_report_t do_send_report) {
-    if (suspended || (or_items == 0)) {
+    if (suspended || (or_total_items == 0)) {
         return false;
     }
 
-    uint8_t report_id = outgoing_reports[or_head][0];
+    // oldest report across all report IDs
+    uint8_t report_id = 0;
+    bool found = false;
+    for (uint8_t id : report_ids) {
+        if ((or_items[id] > 0) &&
+            (!found || ((int32_t) (outgoing_report_meta(id, 0).seq - outgoing_report_meta(report_id, 0).seq) < 0))) {
+            report_id = id;
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
 
     bool sent = false;
     if (our_descriptor == &our_descriptors[our_descriptor_number]) {
-        sent = do_send_report(0, outgoing_reports[or_head], report_sizes[report_id] + 1);
+        sent = do_send_report(0, outgoing_report_with_id(outgoing_report(report_id, 0)), report_sizes[report_id] + 1);
+    }
+    if (sent) {
+        const outgoing_report_meta_t& meta = outgoing_report_meta(report_id, 0);
+        in_flight_send_time = get_time();
+        in_flight_input_time = meta.input_time;
+        record_latency(LatencyStage::QUEUED, in_flight_send_time - meta.queued_time);
     }
 
     // XXX even if not sent?
-    or_head = (or_head + 1) % OR_BUFSIZE;
-    or_items--;
+    or_head[report_id] = (or_head[report_id] + 1) % OUTGOING_QUEUE_SLOTS;
+    or_items[report_id]--;
+    or_total_items--;
+    promote_pending_report(report_id);
 
     reports_sent++;
 
     return sent;
 }
 
+// Called when the host has picked up the last report we sent.
+void report_delivered() {
+    if (in_flight_send_time == 0) {
+        return;
+    }
+    uint64_t now = get_time();
+    record_latency(LatencyStage::USB, now - in_flight_send_time);
+    if (in_flight_input_time != 0) {
+        record_latency(LatencyStage::END_TO_END, now - in_flight_input_time);
+    }
+    in_flight_send_time = 0;
+}
+
 bool send_monitor_report(send_report_t do_send_report) {
     if ((monitor_usages_queued == 0) || suspended) {
         return false;
@@ -1467,22 +2608,25 @@ bool send_monitor_report(send_report_t do_send_report) {
     return sent;
 }
 
-void monitor_usage(uint32_t usage, int32_t value, uint8_t hub_port) {
+bool monitor_usage(uint32_t usage, int32_t value, uint8_t hub_port) {
     if (monitor_usages_queued == sizeof(monitor_report[0].items) / sizeof(monitor_report[0].items[0])) {
-        return;
+        return false;
     }
     monitor_report[monitor_report_idx].items[monitor_usages_queued++] = {
         .usage = usage,
         .value = value,
         .hub_port = hub_port,
     };
+    return true;
 }
 
+inline void store_input(const usage_def_t& their_usage, int32_t value, uint8_t interface_idx);
+
 inline void read_input(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, uint8_t interface_idx) {
     int32_t value = 0;
     if (their_usage.is_array) {
         for (unsigned int i = 0; i < their_usage.count; i++) {
-            uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+            uint32_t bits = get_bits(their_usage.kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
             if (((their_usage.index_mask == 0) && (bits == their_usage.index)) ||
                 (their_usage.index_mask & (1 << bits))) {
                 value = 1;
@@ -1490,7 +2634,7 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
             }
         }
     } else {
-        value = get_bits(report, len, their_usage.bitpos, their_usage.size);
+        value = get_bits(their_usage.kernel, report, len, their_usage.bitpos, their_usage.size);
         if ((their_usage.logical_minimum < 0) || (their_usage.logical_maximum < 0)) {
             if (value & (1 << (their_usage.size - 1))) {
                 value |= 0xFFFFFFFF << their_usage.size;
@@ -1498,12 +2642,16 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
         }
     }
 
+    store_input(their_usage, value, interface_idx);
+}
+
+inline void store_input(const usage_def_t& their_usage, int32_t value, uint8_t interface_idx) {
     if (their_usage.is_relative) {
         if (their_usage.input_state_0 != NULL) {
-            *(their_usage.input_state_0) += value;
+            update_state(their_usage.input_state_0, *(their_usage.input_state_0) + value);
         }
         if (their_usage.input_state_n != NULL) {
-            *(their_usage.input_state_n) = value;  // XXX does it need to be += ?
+            update_state(their_usage.input_state_n, value);  // XXX does it need to be += ?
         }
     } else {
         int32_t scaled_value;
@@ -1515,16 +2663,16 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
         if (their_usage.input_state_0 != NULL) {
             if ((their_usage.size == 1) || their_usage.is_array) {
                 if (value) {
-                    *(their_usage.input_state_0) |= 1 << interface_idx;
+                    update_state(their_usage.input_state_0, *(their_usage.input_state_0) | (1 << interface_idx));
                 } else {
-                    *(their_usage.input_state_0) &= ~(1 << interface_idx);
+                    update_state(their_usage.input_state_0, *(their_usage.input_state_0) & ~(1 << interface_idx));
                 }
             } else {
-                *(their_usage.input_state_0) = scaled_value;
+                update_state(their_usage.input_state_0, scaled_value);
             }
         }
         if (their_usage.input_state_n != NULL) {
-            *(their_usage.input_state_n) = scaled_value;
+            update_state(their_usage.input_state_n, scaled_value);
         }
     }
 }
@@ -1532,19 +2680,41 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
 inline void read_input_range(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, uint8_t interface_idx, uint8_t hub_port) {
     // is_array and !is_relative is implied
     for (unsigned int i = 0; i < their_usage.count; i++) {
-        uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        uint32_t bits = get_bits(their_usage.kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
         // XXX consider negative indexes
         if ((bits >= their_usage.logical_minimum) &&
             (bits <= their_usage.logical_minimum + their_usage.usage_maximum - source_usage)) {
             uint32_t actual_usage = source_usage + bits - their_usage.logical_minimum;
             int32_t* state_ptr_0 = get_state_ptr(actual_usage, 0);
             if (state_ptr_0 != NULL) {
-                *state_ptr_0 |= 1 << interface_idx;
+                update_state(state_ptr_0, *state_ptr_0 | (1 << interface_idx));
             }
             if (hub_port != HUB_PORT_NONE) {
                 int32_t* state_ptr_n = get_state_ptr(actual_usage, hub_port);
                 if (state_ptr_n != NULL) {
-                    *state_ptr_n = 1 << interface_idx;  // set the bit because in do_handle_received_report we clear it not knowing if it's "0" or "n"
+                    update_state(state_ptr_n, 1 << interface_idx);  // set the bit because in do_handle_received_report we clear it not knowing if it's "0" or "n"
+                }
+            }
+        }
+    }
+}
+
+// Same as above, but with the state pointers for the whole range looked up in advance.
+inline void read_input_range_table(const uint8_t* report, int len, const field_decode_t& their, const decode_tables_t* tables, uint8_t interface_idx) {
+    const usage_def_t& their_usage = their.usage_def;
+    for (unsigned int i = 0; i < their_usage.count; i++) {
+        uint32_t bits = get_bits(their_usage.kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        // unsigned like in read_input_range(), negative minimums never match
+        if ((bits >= (uint32_t) their_usage.logical_minimum) &&
+            (bits <= their_usage.logical_minimum + their_usage.usage_maximum - their.usage)) {
+            uint16_t slot = tables->range_slots[their.range_start + bits - their_usage.logical_minimum];
+            if (slot != NO_RANGE_STATE) {
+                const range_state_t& range_state = tables->range_states[slot];
+                if (range_state.state_ptr_0 != NULL) {
+                    update_state(range_state.state_ptr_0, *range_state.state_ptr_0 | (1 << interface_idx));
+                }
+                if (range_state.state_ptr_n != NULL) {
+                    update_state(range_state.state_ptr_n, 1 << interface_idx);
                 }
             }
         }
@@ -1555,7 +2725,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
     int32_t value = 0;
     if (their_usage.is_array) {
         for (unsigned int i = 0; i < their_usage.count; i++) {
-            uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+            uint32_t bits = get_bits(their_usage.kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
             if (((their_usage.index_mask == 0) && (bits == their_usage.index)) ||
                 (their_usage.index_mask & (1 << bits))) {
                 value = 1;
@@ -1563,7 +2733,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
             }
         }
     } else {
-        value = get_bits(report, len, their_usage.bitpos, their_usage.size);
+        value = get_bits(their_usage.kernel, report, len, their_usage.bitpos, their_usage.size);
         if ((their_usage.logical_minimum < 0) || (their_usage.logical_maximum < 0)) {
             if (value & (1 << (their_usage.size - 1))) {
                 value |= 0xFFFFFFFF << their_usage.size;
@@ -1597,7 +2767,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
 inline void monitor_read_input_range(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, uint8_t interface_idx, uint8_t hub_port) {
     // is_array and !is_relative is implied
     for (unsigned int i = 0; i < their_usage.count; i++) {
-        uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        uint32_t bits = get_bits(their_usage.kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
         // XXX consider negative indexes
         if ((bits >= their_usage.logical_minimum) &&
             (bits <= their_usage.logical_minimum + their_usage.usage_maximum - source_usage)) {
@@ -1611,21 +2781,26 @@ inline void monitor_read_input_range(const uint8_t* report, int len, uint32_t so
 }
 
 void handle_received_report(const uint8_t* report, int len, uint16_t interface, uint8_t external_report_id) {
+    report_received_time = get_time();
+    if (first_unprocessed_report_time == 0) {
+        first_unprocessed_report_time = report_received_time;
+    }
     if (our_descriptor->handle_received_report != nullptr) {
         our_descriptor->handle_received_report(report, len, interface, external_report_id);
     }
 }
 
-static inline bool is_rollover(const uint8_t* report, int len, uint16_t interface, uint8_t report_id) {
-    for (auto const& usage_def : rollover_usages[interface][report_id]) {
+static inline bool is_rollover(const uint8_t* report, int len, const decode_tables_t* tables, const report_decode_t& report_decode) {
+    for (uint16_t i = report_decode.rollover_start; i < report_decode.rollover_end; i++) {
+        const usage_def_t& usage_def = tables->rollover_fields[i];
         if (usage_def.is_array) {
             for (unsigned int i = 0; i < usage_def.count; i++) {
-                if (get_bits(report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.index) {
+                if (get_bits(usage_def.kernel, report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.index) {
                     return true;
                 }
             }
         } else {
-            if (get_bits(report, len, usage_def.bitpos, usage_def.size) != 0) {
+            if (get_bits(usage_def.kernel, report, len, usage_def.bitpos, usage_def.size) != 0) {
                 return true;
             }
         }
@@ -1634,6 +2809,162 @@ static inline bool is_rollover(const uint8_t* report, int len, uint16_t interfac
     return false;
 }
 
+// The device's report has the same layout as ours and the config doesn't
+// change anything, so there's nothing to decode and nothing to map.
+void pass_report_through(const uint8_t* report, int len, uint8_t report_id, const decode_tables_t* tables) {
+    uint16_t size = report_sizes[report_id];
+    uint8_t* our_report = reports[report_id];
+    const uint8_t* relative = (const uint8_t*) report_masks_relative[report_id];
+    const uint8_t* absolute = (const uint8_t*) report_masks_absolute[report_id];
+    // constant bits and anything past the end of a short report keep their cleared state
+    for (int i = 0; (i < len) && (i < size); i++) {
+        uint8_t mask = relative[i] | absolute[i];
+        our_report[i] = (report[i] & mask) | (our_report[i] & ~mask);
+    }
+    for (auto const& scroll : tables->passthrough_scroll) {
+        const usage_def_t& usage_def = scroll.usage_def;
+        if ((usage_def.report_id != report_id) || !(resolution_multiplier & scroll.resolution_multiplier_mask)) {
+            continue;
+        }
+        int32_t value = get_bits(usage_def.kernel, our_report, size, usage_def.bitpos, usage_def.size);
+        if ((usage_def.logical_minimum < 0) && (value & (1 << (usage_def.size - 1)))) {
+            value |= 0xFFFFFFFF << usage_def.size;
+        }
+        put_bits(usage_def.kernel, our_report, size, usage_def.bitpos, usage_def.size, value * RESOLUTION_MULTIPLIER);
+    }
+    if (our_descriptor->sanitize_report != nullptr) {
+        our_descriptor->sanitize_report(report_id, our_report, size);
+    }
+    if (queue_outgoing_report(report_id, report_received_time)) {
+        held_passthrough_mask &= ~(1 << report_id);
+    } else {
+        // the relative values went into the waiting state already
+        for (int i = 0; i < report_words[report_id]; i++) {
+            held_passthrough_reports[report_id][i] = ((uint32_t*) our_report)[i] & ~report_masks_relative[report_id][i];
+        }
+        held_passthrough_input_time[report_id] = report_received_time;
+        held_passthrough_mask |= 1 << report_id;
+    }
+    if (our_descriptor->clear_report != nullptr) {
+        our_descriptor->clear_report(our_report, report_id, size);
+    } else {
+        memset(our_report, 0, size);
+    }
+}
+
+// Same layout as our reports, so our masks apply. Relative values are left
+// out, they were already sent.
+void remember_passthrough_report(const uint8_t* report, int len, uint8_t report_id) {
+    if (len > MAX_REPORT_SIZE) {
+        len = MAX_REPORT_SIZE;
+    }
+    const uint8_t* relative = (const uint8_t*) report_masks_relative[report_id];
+    for (int i = 0; i < len; i++) {
+        last_passthrough_reports[report_id][i] = (i < report_sizes[report_id]) ? (report[i] & ~relative[i]) : report[i];
+    }
+    last_passthrough_lens[report_id] = len;
+    last_passthrough_mask |= 1 << report_id;
+}
+
+// Updates input_state from one of the device's reports.
+void decode_report(const uint8_t* report, int len, const decode_tables_t* tables, const interface_decode_t* interface_decode, const report_decode_t& report_decode) {
+    uint8_t interface_idx = interface_decode->interface_index;
+    uint8_t hub_port = interface_decode->hub_port;
+
+    for (uint16_t i = report_decode.array_ranges_start; i < report_decode.array_ranges_end; i++) {
+        int32_t* state_ptr = tables->array_range_states[i];
+        update_state(state_ptr, *state_ptr & ~(1 << interface_idx));
+    }
+
+    for (uint16_t i = report_decode.button_runs_start; i < report_decode.button_runs_end; i++) {
+        const button_run_t& run = tables->button_runs[i];
+        button_run_state_t& run_state = button_run_states[i];
+        uint32_t bits = get_bits(report, len, run.bitpos, run.size) & run.mask;
+        uint32_t changed = run_state.primed ? (bits ^ run_state.previous) : run.mask;
+        run_state.previous = bits;
+        run_state.primed = true;
+        while (changed) {
+            uint8_t bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            const range_state_t& button = tables->buttons[run.buttons_start + bit];
+            if ((bits >> bit) & 1) {
+                if (button.state_ptr_0 != NULL) {
+                    update_state(button.state_ptr_0, *button.state_ptr_0 | (1 << interface_idx));
+                }
+                if (button.state_ptr_n != NULL) {
+                    update_state(button.state_ptr_n, 1);
+                }
+            } else {
+                if (button.state_ptr_0 != NULL) {
+                    update_state(button.state_ptr_0, *button.state_ptr_0 & ~(1 << interface_idx));
+                }
+                if (button.state_ptr_n != NULL) {
+                    update_state(button.state_ptr_n, 0);
+                }
+            }
+        }
+    }
+
+    // decode each array field once instead of scanning it for every mapped usage
+    memset(decoded_arrays, 0, sizeof(decoded_arrays[0]) * (report_decode.array_fields_end - report_decode.array_fields_start));
+    for (uint16_t i = report_decode.array_fields_start; i < report_decode.array_fields_end; i++) {
+        const array_field_t& array_field = tables->array_fields[i];
+        uint32_t* bitset = decoded_arrays[i - report_decode.array_fields_start];
+        for (unsigned int j = 0; j < array_field.count; j++) {
+            uint32_t bits = get_bits(array_field.kernel, report, len, array_field.bitpos + j * array_field.size, array_field.size);
+            bitset[bits >> 5] |= 1 << (bits & 31);
+        }
+    }
+
+    for (uint16_t i = report_decode.fields_start; i < report_decode.fields_end; i++) {
+        const field_decode_t& their = tables->fields[i];
+        if (their.decoded_array != NO_DECODED_ARRAY) {
+            const uint32_t* bitset = decoded_arrays[their.decoded_array];
+            uint32_t index = their.usage_def.index;
+            int32_t value;
+            if (their.usage_def.index_mask == 0) {
+                value = (index < 256) && ((bitset[index >> 5] >> (index & 31)) & 1);
+            } else {
+                value = (bitset[0] & their.usage_def.index_mask) != 0;
+            }
+            store_input(their.usage_def, value, interface_idx);
+        } else if (their.usage_def.usage_maximum == 0) {
+            read_input(report, len, their.usage, their.usage_def, interface_idx);
+        } else if (their.range_start != NO_RANGE_TABLE) {
+            read_input_range_table(report, len, their, tables, interface_idx);
+        } else {
+            read_input_range(report, len, their.usage, their.usage_def, interface_idx, hub_port);
+        }
+    }
+}
+
+// When a device's reports stop being passed through, input_state picks up
+// from its last state instead of whatever it held before passthrough began.
+void decode_last_passthrough_reports(const decode_tables_t* prev_tables, const decode_tables_t* tables) {
+    if ((prev_tables->passthrough_interface == NO_PASSTHROUGH) || (last_passthrough_mask == 0)) {
+        return;
+    }
+    uint16_t interface = prev_tables->interface_ids[prev_tables->passthrough_interface];
+    for (unsigned int i = 0; i < tables->interface_ids.size(); i++) {
+        const interface_decode_t& interface_decode = tables->interfaces[i];
+        if (tables->interface_ids[i] != interface) {
+            continue;
+        }
+        if (interface_decode.passthrough) {
+            return;
+        }
+        for (uint8_t report_id = 0; report_id <= MAX_INPUT_REPORT_ID; report_id++) {
+            uint8_t report_slot = interface_decode.report_slot[report_id];
+            if (!(last_passthrough_mask & (1 << report_id)) || (report_slot == NO_REPORT_DECODE)) {
+                continue;
+            }
+            decode_report(last_passthrough_reports[report_id], last_passthrough_lens[report_id], tables,
+                &interface_decode, tables->reports[interface_decode.reports_start + report_slot]);
+        }
+    }
+    last_passthrough_mask = 0;
+}
+
 void do_handle_received_report(const uint8_t* report, int len, uint16_t interface, uint8_t external_report_id) {
     if (len == 0) {
         return;
@@ -1641,10 +2972,21 @@ void do_handle_received_report(const uint8_t* report, int len, uint16_t interfac
 
     reports_received++;
 
-    my_mutex_enter(MutexId::THEIR_USAGES);
+    const decode_tables_t* tables = active_decode_tables.load(std::memory_order_acquire);
+    // there's only ever a handful of interfaces, a scan is cheaper than hashing
+    const interface_decode_t* interface_decode = NULL;
+    for (unsigned int i = 0; i < tables->interface_ids.size(); i++) {
+        if (tables->interface_ids[i] == interface) {
+            interface_decode = &tables->interfaces[i];
+            break;
+        }
+    }
+    if (interface_decode == NULL) {
+        return;
+    }
 
     uint8_t report_id = 0;
-    if (has_report_id_theirs[interface]) {
+    if (interface_decode->has_report_id) {
         if (external_report_id != 0) {
             report_id = external_report_id;
         } else {
@@ -1654,34 +2996,38 @@ void do_handle_received_report(const uint8_t* report, int len, uint16_t interfac
         }
     }
 
-    uint8_t interface_idx = interface_index[interface];
-    uint8_t hub_port = hub_ports[interface >> 8];
+    uint8_t interface_idx = interface_decode->interface_index;
+    uint8_t hub_port = interface_decode->hub_port;
 
-    if (!is_rollover(report, len, interface, report_id)) {
-        for (int32_t* state_ptr : array_range_usages[interface][report_id]) {
-            *state_ptr &= ~(1 << interface_idx);
-        }
-
-        for (auto const& their : their_used_usages[interface][report_id]) {
-            if (their.usage_def.usage_maximum == 0) {
-                read_input(report, len, their.usage, their.usage_def, interface_idx);
-            } else {
-                read_input_range(report, len, their.usage, their.usage_def, interface_idx, hub_port);
-            }
+    uint8_t report_slot = interface_decode->report_slot[report_id];
+    if (report_slot != NO_REPORT_DECODE) {
+        const report_decode_t& report_decode = tables->reports[interface_decode->reports_start + report_slot];
+        bool rollover = is_rollover(report, len, tables, report_decode);
+        if (!rollover && interface_decode->passthrough) {
+            pass_report_through(report, len, report_id, tables);
+            remember_passthrough_report(report, len, report_id);
+        } else if (!rollover) {
+            decode_report(report, len, tables, interface_decode, report_decode);
         }
     }
 
     if (monitor_enabled) {
-        for (auto const& [their_usage, their_usage_def] : their_usages[interface][report_id]) {
-            if (their_usage_def.usage_maximum == 0) {
-                monitor_read_input(report, len, their_usage, their_usage_def, interface_idx, hub_port);
-            } else {
-                monitor_read_input_range(report, len, their_usage, their_usage_def, interface_idx, hub_port);
+        my_mutex_enter(MutexId::THEIR_USAGES);
+        auto interface_search = their_usages.find(interface);
+        if (interface_search != their_usages.end()) {
+            auto report_search = interface_search->second.find(report_id);
+            if (report_search != interface_search->second.end()) {
+                for (auto const& [their_usage, their_usage_def] : report_search->second) {
+                    if (their_usage_def.usage_maximum == 0) {
+                        monitor_read_input(report, len, their_usage, their_usage_def, interface_idx, hub_port);
+                    } else {
+                        monitor_read_input_range(report, len, their_usage, their_usage_def, interface_idx, hub_port);
+                    }
+                }
             }
         }
+        my_mutex_exit(MutexId::THEIR_USAGES);
     }
-
-    my_mutex_exit(MutexId::THEIR_USAGES);
 }
 
 void handle_received_midi(uint8_t hub_port, uint8_t* midi_msg) {
@@ -1733,11 +3079,11 @@ void handle_received_midi(uint8_t hub_port, uint8_t* midi_msg) {
 void set_input_state(uint32_t usage, int32_t state_raw, int32_t state_scaled, uint8_t hub_port) {
     int32_t* state_ptr = get_state_ptr(usage, hub_port, false, true);
     if (state_ptr != NULL) {
-        *state_ptr = state_raw;
+        update_state(state_ptr, state_raw);
     }
     state_ptr = get_state_ptr(usage, hub_port, false, false);
     if (state_ptr != NULL) {
-        *state_ptr = state_scaled;
+        update_state(state_ptr, state_scaled);
     }
 }
 
@@ -1781,19 +3127,245 @@ bool should_scale_input(const usage_def_t& their_usage) {
     return true;
 }
 
+// Moves plain 1-bit fields out of the field list and into button runs.
+// Skipping unchanged buttons is only correct if nothing else writes the same
+// state, so a button only qualifies if its report is the only writer of its
+// input_state_n and of its interface's bit in input_state_0.
+static void build_button_runs(decode_tables_t* tables) {
+    std::unordered_map<int32_t*, uint8_t> value_writers;
+    std::unordered_map<uint64_t, uint8_t> bit_writers;  // state ptr + interface_idx
+
+    for (unsigned int k = 0; k < tables->interfaces.size(); k++) {
+        const interface_decode_t& interface_decode = tables->interfaces[k];
+        uint16_t reports_end = (k + 1 < tables->interfaces.size()) ? tables->interfaces[k + 1].reports_start : tables->reports.size();
+        for (uint16_t r = interface_decode.reports_start; r < reports_end; r++) {
+            const report_decode_t& report_decode = tables->reports[r];
+            for (uint16_t i = report_decode.fields_start; i < report_decode.fields_end; i++) {
+                const usage_def_t& field_def = tables->fields[i].usage_def;
+                if (field_def.usage_maximum != 0) {
+                    continue;  // array range states are all in array_range_states
+                }
+                if (field_def.input_state_0 != NULL) {
+                    if (!field_def.is_relative && ((field_def.size == 1) || field_def.is_array)) {
+                        bit_writers[((uint64_t) (uintptr_t) field_def.input_state_0 << 8) | interface_decode.interface_index]++;
+                    } else {
+                        value_writers[field_def.input_state_0]++;
+                    }
+                }
+                if (field_def.input_state_n != NULL) {
+                    value_writers[field_def.input_state_n]++;
+                }
+            }
+            for (uint16_t i = report_decode.array_ranges_start; i < report_decode.array_ranges_end; i++) {
+                value_writers[tables->array_range_states[i]]++;
+            }
+        }
+    }
+
+    std::vector<field_decode_t> fields;
+    fields.reserve(tables->fields.size());
+
+    for (unsigned int k = 0; k < tables->interfaces.size(); k++) {
+        const interface_decode_t& interface_decode = tables->interfaces[k];
+        uint16_t reports_end = (k + 1 < tables->interfaces.size()) ? tables->interfaces[k + 1].reports_start : tables->reports.size();
+        for (uint16_t r = interface_decode.reports_start; r < reports_end; r++) {
+            report_decode_t& report_decode = tables->reports[r];
+            std::vector<button_run_t> runs;
+            std::vector<std::array<range_state_t, 32>> run_buttons;
+            uint16_t fields_start = fields.size();
+
+            for (uint16_t i = report_decode.fields_start; i < report_decode.fields_end; i++) {
+                const usage_def_t& field_def = tables->fields[i].usage_def;
+                bool eligible =
+                    (field_def.size == 1) && (field_def.usage_maximum == 0) &&
+                    !field_def.is_array && !field_def.is_relative && !field_def.should_be_scaled &&
+                    (field_def.logical_minimum >= 0) && (field_def.logical_maximum >= 0) &&
+                    ((field_def.input_state_0 == NULL) ||
+                        ((value_writers.count(field_def.input_state_0) == 0) &&
+                            (bit_writers[((uint64_t) (uintptr_t) field_def.input_state_0 << 8) | interface_decode.interface_index] == 1))) &&
+                    ((field_def.input_state_n == NULL) || (value_writers[field_def.input_state_n] == 1));
+                if (!eligible) {
+                    fields.push_back(tables->fields[i]);
+                    continue;
+                }
+                unsigned int j = 0;
+                for (; j < runs.size(); j++) {
+                    if ((field_def.bitpos >= runs[j].bitpos) && (field_def.bitpos < runs[j].bitpos + 32) &&
+                        !(runs[j].mask & (1 << (field_def.bitpos - runs[j].bitpos)))) {
+                        break;
+                    }
+                }
+                if (j == runs.size()) {
+                    runs.push_back((button_run_t){
+                        .bitpos = field_def.bitpos,
+                        .size = 0,
+                        .mask = 0,
+                        .buttons_start = 0,
+                    });
+                    run_buttons.push_back({});
+                }
+                uint8_t bit = field_def.bitpos - runs[j].bitpos;
+                runs[j].mask |= 1 << bit;
+                if (bit + 1 > runs[j].size) {
+                    runs[j].size = bit + 1;
+                }
+                run_buttons[j][bit] = (range_state_t){
+                    .state_ptr_0 = field_def.input_state_0,
+                    .state_ptr_n = field_def.input_state_n,
+                };
+            }
+
+            report_decode.fields_start = fields_start;
+            report_decode.fields_end = fields.size();
+            report_decode.button_runs_start = tables->button_runs.size();
+            for (unsigned int j = 0; j < runs.size(); j++) {
+                runs[j].buttons_start = tables->buttons.size();
+                tables->buttons.insert(tables->buttons.end(), run_buttons[j].begin(), run_buttons[j].begin() + runs[j].size);
+                tables->button_runs.push_back(runs[j]);
+            }
+            report_decode.button_runs_end = tables->button_runs.size();
+        }
+    }
+
+    tables->fields.swap(fields);
+}
+
+bool same_usage_def(const usage_def_t& a, const usage_def_t& b) {
+    return (a.report_id == b.report_id) &&
+           (a.size == b.size) &&
+           (a.bitpos == b.bitpos) &&
+           (a.is_relative == b.is_relative) &&
+           (a.is_array == b.is_array) &&
+           (a.logical_minimum == b.logical_minimum) &&
+           (a.logical_maximum == b.logical_maximum) &&
+           (a.index == b.index) &&
+           (a.count == b.count) &&
+           (a.usage_maximum == b.usage_maximum) &&
+           (a.index_mask == b.index_mask);
+}
+
+bool same_usages(const std::unordered_map<uint8_t, std::unordered_map<uint32_t, usage_def_t>>& theirs) {
+    if (theirs.size() != our_usages.size()) {
+        return false;
+    }
+    for (auto const& [report_id, usage_map] : theirs) {
+        auto our_search = our_usages.find(report_id);
+        if ((our_search == our_usages.end()) || (our_search->second.size() != usage_map.size())) {
+            return false;
+        }
+        for (auto const& [usage, usage_def] : usage_map) {
+            auto usage_search = our_search->second.find(usage);
+            if ((usage_search == our_search->second.end()) || !same_usage_def(usage_def, usage_search->second)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Identity mappings are what unmapped passthrough would do anyway.
+bool config_maps_identity() {
+    if (!(unmapped_passthrough_layer_mask & 1)) {
+        return false;
+    }
+    for (auto const& mapping : config_mappings) {
+        if ((mapping.target_usage != mapping.source_usage) ||
+            ((mapping.source_usage & 0xFFF00000) == 0xFFF00000) ||
+            (mapping.scaling != 1000) ||
+            !(mapping.layer_mask & 1) ||
+            (mapping.flags != 0) ||
+            (mapping.hub_ports != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// If there's only one device sending inputs, it describes its reports
+// exactly like we do and the config doesn't change anything, its reports
+// can go out as they came in.
+void find_passthrough_interface(decode_tables_t* tables) {
+    tables->passthrough_interface = NO_PASSTHROUGH;
+    tables->passthrough_scroll.clear();
+
+    uint8_t candidate = NO_PASSTHROUGH;
+    for (unsigned int i = 0; i < tables->interface_ids.size(); i++) {
+        uint16_t interface = tables->interface_ids[i];
+        if (interface == OUR_OUT_INTERFACE) {
+            continue;
+        }
+        for (auto const& [report_id, usage_map] : their_usages[interface]) {
+            if (!usage_map.empty()) {
+                if (candidate != NO_PASSTHROUGH) {
+                    return;
+                }
+                candidate = i;
+                break;
+            }
+        }
+    }
+
+    if ((candidate == NO_PASSTHROUGH) ||
+        !config_maps_identity() ||
+        !same_usages(their_usages[tables->interface_ids[candidate]])) {
+        return;
+    }
+
+    // what handle_scroll() would do with an identity mapping
+    for (auto const& [report_id, usage_map] : our_usages) {
+        for (auto const& [usage, usage_def] : usage_map) {
+            if (usage_def.is_relative && ((usage == V_SCROLL_USAGE) || (usage == H_SCROLL_USAGE))) {
+                tables->passthrough_scroll.push_back((scroll_field_t){
+                    .usage_def = usage_def,
+                    .resolution_multiplier_mask = resolution_multiplier_masks[usage == H_SCROLL_USAGE],
+                });
+            }
+        }
+    }
+    tables->interfaces[candidate].passthrough = true;
+    tables->passthrough_interface = candidate;
+}
+
 void update_their_descriptor_derivates() {
     std::unordered_set<int32_t*> relative_usage_set;
     std::unordered_set<int32_t*> binary_usage_set;
     std::set<uint64_t> their_usage_ranges_set;
 
+    decode_tables_t* tables = (active_decode_tables.load() == &decode_tables[0]) ? &decode_tables[1] : &decode_tables[0];
+
+    my_mutex_enter(MutexId::THEIR_USAGES);
+
     relative_usages.clear();
-    their_used_usages.clear();
-    array_range_usages.clear();
-    rollover_usages.clear();
+    tables->interface_ids.clear();
+    tables->interfaces.clear();
+    tables->reports.clear();
+    tables->fields.clear();
+    tables->array_range_states.clear();
+    tables->rollover_fields.clear();
+    tables->array_fields.clear();
+    tables->range_slots.clear();
+    tables->range_states.clear();
+    tables->button_runs.clear();
+    tables->buttons.clear();
 
     for (auto& [interface, report_id_usage_map] : their_usages) {
         uint8_t hub_port = hub_ports[interface >> 8];
+        tables->interface_ids.push_back(interface);
+        tables->interfaces.push_back((interface_decode_t){
+            .has_report_id = has_report_id_theirs[interface],
+            .interface_index = interface_index[interface],
+            .hub_port = hub_port,
+            .reports_start = (uint16_t) tables->reports.size(),
+        });
+        interface_decode_t& interface_decode = tables->interfaces.back();
+        memset(interface_decode.report_slot, NO_REPORT_DECODE, sizeof(interface_decode.report_slot));
         for (auto& [report_id, usage_map] : report_id_usage_map) {
+            report_decode_t report_decode = {
+                .fields_start = (uint16_t) tables->fields.size(),
+                .array_ranges_start = (uint16_t) tables->array_range_states.size(),
+                .rollover_start = (uint16_t) tables->rollover_fields.size(),
+                .array_fields_start = (uint16_t) tables->array_fields.size(),
+            };
             for (auto [usage, usage_def] : usage_map) {
                 usage_def.should_be_scaled = should_scale_input(usage_def);
                 if (usage_def.usage_maximum == 0) {
@@ -1833,7 +3405,7 @@ void update_their_descriptor_derivates() {
                     if ((state_ptr_0 != NULL) || (state_ptr_n != NULL)) {
                         usage_def.input_state_0 = state_ptr_0;
                         usage_def.input_state_n = state_ptr_n;
-                        their_used_usages[interface][report_id].push_back((usage_usage_def_t){
+                        tables->fields.push_back((field_decode_t){
                             .usage = usage,
                             .usage_def = usage_def,
                         });
@@ -1842,32 +3414,48 @@ void update_their_descriptor_derivates() {
                         usage_def.input_state_0 = state_ptr_raw_0;
                         usage_def.input_state_n = state_ptr_raw_n;
                         usage_def.should_be_scaled = false;
-                        their_used_usages[interface][report_id].push_back((usage_usage_def_t){
+                        tables->fields.push_back((field_decode_t){
                             .usage = usage,
                             .usage_def = usage_def,
                         });
                     }
                     if (usage == ROLLOVER_USAGE) {
-                        rollover_usages[interface][report_id].push_back(usage_def);
+                        tables->rollover_fields.push_back(usage_def);
                     }
                 } else {  // usage_maximum != 0, array range usage
                     their_usage_ranges_set.insert(((uint64_t) usage << 32) | usage_def.usage_maximum);
                     bool any_used = false;
+                    uint32_t range_start = NO_RANGE_TABLE;
+                    if (usage_def.usage_maximum - usage < MAX_RANGE_TABLE) {
+                        range_start = tables->range_slots.size();
+                    }
                     for (uint32_t actual_usage = usage; actual_usage <= usage_def.usage_maximum; actual_usage++) {
                         int32_t* state_ptr_0 = get_state_ptr(actual_usage, 0);
                         int32_t* state_ptr_n = get_state_ptr(actual_usage, hub_port);
+                        if (range_start != NO_RANGE_TABLE) {
+                            int32_t* range_state_ptr_n = (hub_port != HUB_PORT_NONE) ? state_ptr_n : NULL;
+                            if ((state_ptr_0 != NULL) || (range_state_ptr_n != NULL)) {
+                                tables->range_slots.push_back(tables->range_states.size());
+                                tables->range_states.push_back((range_state_t){
+                                    .state_ptr_0 = state_ptr_0,
+                                    .state_ptr_n = range_state_ptr_n,
+                                });
+                            } else {
+                                tables->range_slots.push_back(NO_RANGE_STATE);
+                            }
+                        }
                         if (state_ptr_0 != NULL) {
                             any_used = true;
-                            array_range_usages[interface][report_id].push_back(state_ptr_0);
+                            tables->array_range_states.push_back(state_ptr_0);
                             binary_usage_set.insert(state_ptr_0);
                         }
                         if (state_ptr_n != NULL) {
                             any_used = true;
-                            array_range_usages[interface][report_id].push_back(state_ptr_n);
+                            tables->array_range_states.push_back(state_ptr_n);
                             binary_usage_set.insert(state_ptr_n);
                         }
                         if (actual_usage == ROLLOVER_USAGE) {
-                            rollover_usages[interface][report_id].push_back((usage_def_t){
+                            tables->rollover_fields.push_back((usage_def_t){
                                 .size = usage_def.size,
                                 .bitpos = usage_def.bitpos,
                                 .is_array = true,
@@ -1877,16 +3465,64 @@ void update_their_descriptor_derivates() {
                         }
                     }
                     if (any_used) {
-                        their_used_usages[interface][report_id].push_back((usage_usage_def_t){
+                        tables->fields.push_back((field_decode_t){
                             .usage = usage,
                             .usage_def = usage_def,
+                            .range_start = range_start,
                         });
+                    } else if (range_start != NO_RANGE_TABLE) {
+                        tables->range_slots.resize(range_start);
                     }
                 }
             }
+
+            // Some keyboards have the same usage as both non-array and array inputs.
+            // By reading the non-array ones first we get the right result regardless of which they actually use.
+            std::sort(tables->fields.begin() + report_decode.fields_start, tables->fields.end(),
+                [](const field_decode_t& a, const field_decode_t& b) {
+                    return (a.usage_def.is_array < b.usage_def.is_array);
+                });
+
+            for (auto it = tables->fields.begin() + report_decode.fields_start; it != tables->fields.end(); it++) {
+                const usage_def_t& field_def = it->usage_def;
+                if (!field_def.is_array || field_def.is_relative || (field_def.usage_maximum != 0) ||
+                    (field_def.size == 0) || (field_def.size > 8)) {
+                    continue;
+                }
+                uint16_t i = report_decode.array_fields_start;
+                while ((i < tables->array_fields.size()) &&
+                       ((tables->array_fields[i].bitpos != field_def.bitpos) ||
+                           (tables->array_fields[i].size != field_def.size) ||
+                           (tables->array_fields[i].count != field_def.count) ||
+                           (tables->array_fields[i].kernel != field_def.kernel))) {
+                    i++;
+                }
+                if (i - report_decode.array_fields_start >= MAX_DECODED_ARRAYS) {
+                    continue;
+                }
+                if (i == tables->array_fields.size()) {
+                    tables->array_fields.push_back((array_field_t){
+                        .bitpos = field_def.bitpos,
+                        .size = field_def.size,
+                        .count = field_def.count,
+                        .kernel = field_def.kernel,
+                    });
+                }
+                it->decoded_array = i - report_decode.array_fields_start;
+            }
+
+            report_decode.fields_end = tables->fields.size();
+            report_decode.array_ranges_end = tables->array_range_states.size();
+            report_decode.rollover_end = tables->rollover_fields.size();
+            report_decode.array_fields_end = tables->array_fields.size();
+            interface_decode.report_slot[report_id] = tables->reports.size() - interface_decode.reports_start;
+            tables->reports.push_back(report_decode);
         }
     }
 
+    build_button_runs(tables);
+    find_passthrough_interface(tables);
+
     for (int32_t* ptr : relative_usage_set) {
         relative_usages.push_back(ptr);
     }
@@ -1918,16 +3554,17 @@ void update_their_descriptor_derivates() {
         }
     }
 
-    // Some keyboards have the same usage as both non-array and array inputs.
-    // By reading the non-array ones first we get the right result regardless of which they actually use.
-    for (auto& [interface, report_id_usages_map] : their_used_usages) {
-        for (auto& [report_id, usages_vector] : report_id_usages_map) {
-            std::sort(usages_vector.begin(), usages_vector.end(),
-                [](const usage_usage_def_t& a, const usage_usage_def_t& b) {
-                    return (a.usage_def.is_array < b.usage_def.is_array);
-                });
-        }
-    }
+    my_mutex_exit(MutexId::THEIR_USAGES);
+
+    // still intact, the next rebuild is the one that reuses it
+    const decode_tables_t* prev_tables = active_decode_tables.load(std::memory_order_relaxed);
+
+    button_run_states.assign(tables->button_runs.size(), button_run_state_t());
+    active_decode_tables.store(tables, std::memory_order_release);
+
+    decode_last_passthrough_reports(prev_tables, tables);
+
+    compile_mapping_program();
 }
 
 void parse_our_descriptor() {
@@ -1943,14 +3580,21 @@ void parse_our_descriptor() {
 
     for (unsigned int i = 0; i < report_ids.size(); i++) {
         uint8_t report_id = report_ids[i];
-        delete[] reports[report_id];
-        delete[] prev_reports[report_id];
+        delete[] (uint32_t*) reports[report_id];
+        delete[] (uint32_t*) prev_reports[report_id];
         delete[] report_masks_relative[report_id];
         delete[] report_masks_absolute[report_id];
+        our_relative_usages[report_id].clear();
     }
 
     report_ids.clear();
+    memset(or_items, 0, sizeof(or_items));
+    memset(or_pending, 0, sizeof(or_pending));
+    or_total_items = 0;
+    held_passthrough_mask = 0;
+    last_passthrough_mask = 0;
     memset(report_sizes, 0, sizeof(report_sizes));
+    memset(report_words, 0, sizeof(report_words));
     memset(reports, 0, sizeof(reports));
     memset(prev_reports, 0, sizeof(prev_reports));
     memset(report_masks_relative, 0, sizeof(report_masks_relative));
@@ -1965,15 +3609,13 @@ void parse_our_descriptor() {
         boot_protocol_keyboard ? boot_kb_report_descriptor_length : our_descriptor->descriptor_length);
 
     for (auto const& [report_id, size] : report_sizes_map[ReportType::INPUT]) {
+        uint8_t words = (size + 3) / 4;
         report_sizes[report_id] = size;
-        reports[report_id] = new uint8_t[size];
-        memset(reports[report_id], 0, size);
-        prev_reports[report_id] = new uint8_t[size];
-        memset(prev_reports[report_id], 0, size);
-        report_masks_relative[report_id] = new uint8_t[size];
-        memset(report_masks_relative[report_id], 0, size);
-        report_masks_absolute[report_id] = new uint8_t[size];
-        memset(report_masks_absolute[report_id], 0, size);
+        report_words[report_id] = words;
+        reports[report_id] = (uint8_t*) new uint32_t[words]();
+        prev_reports[report_id] = (uint8_t*) new uint32_t[words]();
+        report_masks_relative[report_id] = new uint32_t[words]();
+        report_masks_absolute[report_id] = new uint32_t[words]();
 
         report_ids.push_back(report_id);
     }
@@ -1994,9 +3636,10 @@ void parse_our_descriptor() {
                 our_usage_ranges_set.insert(((uint64_t) usage << 32) | (usage_def.usage_maximum ? usage_def.usage_maximum : usage));
 
                 if (usage_def.is_relative) {
-                    put_bits(report_masks_relative[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size, 0xFFFFFFFF);
+                    put_bits((uint8_t*) report_masks_relative[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size, 0xFFFFFFFF);
+                    our_relative_usages[report_id].push_back(usage_def);
                 } else {
-                    put_bits(report_masks_absolute[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size, 0xFFFFFFFF);
+                    put_bits((uint8_t*) report_masks_absolute[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size, 0xFFFFFFFF);
                 }
             } else {  // array range
                 our_array_range_usages.push_back((usage_usage_def_t){
@@ -2004,7 +3647,7 @@ void parse_our_descriptor() {
                     .usage_def = usage_def,
                 });
                 our_usage_ranges_set.insert(((uint64_t) usage << 32) | usage_def.usage_maximum);
-                put_bits(report_masks_absolute[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size * usage_def.count, 0xFFFFFFFF);
+                put_bits((uint8_t*) report_masks_absolute[report_id], report_sizes[report_id], usage_def.bitpos, usage_def.size * usage_def.count, 0xFFFFFFFF);
             }
         }
     }
@@ -2022,7 +3665,7 @@ void print_stats() {
 
 void reset_state() {
     memset(registers, 0, sizeof(registers));
-    accumulated.clear();
+    std::fill(mapping_program.accumulator_value.begin(), mapping_program.accumulator_value.end(), 0);
     layer_state_mask = 1;
     frame_counter = 0;
 }
@@ -6,6 +6,9 @@
 #define GPIO_USAGE_PAGE 0xFFF40000
 #define DIGIPOT_USAGE_PAGE 0xFFF60000
 #define DPAD_USAGE_PAGE 0xFFF90000
+// Profiler timings on the monitor interface. Not 0xFFFA, quirks in the
+// example configs use that page.
+#define PROFILER_USAGE_PAGE 0xFFFE0000
 
 #define DPAD_USAGE_LEFT (DPAD_USAGE_PAGE | 1)
 #define DPAD_USAGE_RIGHT (DPAD_USAGE_PAGE | 2)
@@ -29,8 +32,10 @@ void interval_override_updated();
 
 void parse_our_descriptor();
 void process_mapping(bool auto_repeat);
+int32_t eval_expr(uint8_t expr, uint64_t now, bool auto_repeat);
 void update_their_descriptor_derivates();
 bool send_report(send_report_t do_send_report);
+void report_delivered();
 void queue_out_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len);
 void queue_set_feature_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len);
 void queue_get_feature_report(uint16_t interface, uint8_t report_id, uint8_t len);
@@ -40,7 +45,7 @@ void print_stats();
 void reset_state();
 
 void set_monitor_enabled(bool enabled);
-void monitor_usage(uint32_t usage, int32_t value, uint8_t hub_port);
+bool monitor_usage(uint32_t usage, int32_t value, uint8_t hub_port);
 
 void sof_callback();
 
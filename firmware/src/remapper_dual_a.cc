@@ -53,7 +53,9 @@ bool serial_callback(const uint8_t* data, uint16_t len) {
             send_b_init();
             break;
         case DualCommand::START_OF_FRAME:
-            add_alarm_in_us(300, tick_timer_callback, NULL, true);
+            if (!tick_aligned()) {
+                add_alarm_in_us(300, tick_timer_callback, NULL, true);
+            }
             break;
         case DualCommand::GET_FEATURE_RESPONSE: {
             get_feature_response_t* msg = (get_feature_response_t*) data;
@@ -166,4 +168,5 @@ void send_out_report() {
 }
 
 void sof_callback() {
+    tick_sof();
 }
@@ -0,0 +1,325 @@
+#include <tusb.h>
+#include <cstdio>
+#include <cstring>
+
+#include "pio_usb.h"
+#include "usb_midi_host.h"
+
+#include "pico/multicore.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+#include "clone_device.h"
+#include "descriptor_parser.h"
+#include "dual.h"
+#include "out_report.h"
+#include "remapper.h"
+#include "spsc_ring.h"
+#include "tick.h"
+
+// Same as the single build, except the host stack runs on core1. It talks
+// to core0 using the messages the dual builds send over serial.
+
+static spsc_ring_t to_core0_reports;  // reports and MIDI, dropped if core0 falls behind
+static spsc_ring_t to_core0_control;  // mounts, unmounts, cloned identities and feature report responses
+static spsc_ring_t to_core1;          // output and feature reports
+
+static uint8_t core0_buffer[SPSC_RING_MAX_MSG];
+static uint8_t core1_buffer[SPSC_RING_MAX_MSG];
+
+static repeating_timer_t sof_timer;
+
+static bool __no_inline_not_in_flash_func(manual_sof)(repeating_timer_t* rt) {
+    pio_usb_host_frame();
+    if (!tick_aligned()) {
+        set_tick_pending();
+    }
+    return true;
+}
+
+static bool core1_callback(const uint8_t* data, uint16_t len) {
+    switch ((DualCommand) data[0]) {
+        case DualCommand::SEND_OUT_REPORT: {
+            send_out_report_t* msg = (send_out_report_t*) data;
+            do_queue_out_report(msg->report, len - sizeof(send_out_report_t), msg->report_id, msg->dev_addr, msg->interface, OutType::OUTPUT);
+            break;
+        }
+        case DualCommand::SET_FEATURE_REPORT: {
+            set_feature_report_t* msg = (set_feature_report_t*) data;
+            do_queue_out_report(msg->report, len - sizeof(set_feature_report_t), msg->report_id, msg->dev_addr, msg->interface, OutType::SET_FEATURE);
+            break;
+        }
+        case DualCommand::GET_FEATURE_REPORT: {
+            get_feature_report_t* msg = (get_feature_report_t*) data;
+            do_queue_get_report(msg->report_id, msg->dev_addr, msg->interface, msg->len);
+            break;
+        }
+        default:
+            break;
+    }
+    return false;
+}
+
+static void core1_main() {
+    pio_usb_configuration_t pio_cfg = PIO_USB_DEFAULT_CONFIG;
+    pio_cfg.pin_dp = PICO_DEFAULT_PIO_USB_DP_PIN;
+    pio_cfg.skip_alarm_pool = true;
+    tuh_configure(BOARD_TUH_RHPORT, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
+    tuh_init(BOARD_TUH_RHPORT);
+
+    // timer callbacks run on the core that created the pool
+    alarm_pool_t* alarm_pool = alarm_pool_create(2, 4);
+    alarm_pool_add_repeating_timer_us(alarm_pool, -1000, manual_sof, NULL, &sof_timer);
+
+    multicore_fifo_push_blocking(0);
+
+    while (true) {
+        tuh_task();
+        spsc_ring_read(to_core1, core1_callback);
+        do_send_out_report();
+    }
+}
+
+static bool core0_callback(const uint8_t* data, uint16_t len) {
+    bool ret = false;
+    switch ((DualCommand) data[0]) {
+        case DualCommand::DEVICE_CONNECTED: {
+            device_connected_t* msg = (device_connected_t*) data;
+            parse_descriptor(msg->vid, msg->pid, msg->report_descriptor, len - sizeof(device_connected_t), (uint16_t) (msg->dev_addr << 8) | msg->interface, msg->itf_num);
+            device_connected_callback((uint16_t) (msg->dev_addr << 8) | msg->interface, msg->vid, msg->pid, msg->hub_port);
+            break;
+        }
+        case DualCommand::DEVICE_DISCONNECTED: {
+            device_disconnected_t* msg = (device_disconnected_t*) data;
+            device_disconnected_callback(msg->dev_addr);
+            break;
+        }
+        case DualCommand::DEVICE_IDENTITY: {
+            device_identity_t* msg = (device_identity_t*) data;
+            cloned_device_info_t info;
+            info.vid = msg->vid;
+            info.pid = msg->pid;
+            info.bcd_device = msg->bcd_device;
+            memcpy(info.manufacturer, msg->manufacturer, sizeof(info.manufacturer));
+            memcpy(info.product, msg->product, sizeof(info.product));
+            memcpy(info.serial_number, msg->serial_number, sizeof(info.serial_number));
+            info.is_cloned = true;
+            apply_device_identity(info, msg->interval_override);
+            break;
+        }
+        case DualCommand::REPORT_RECEIVED: {
+            report_received_t* msg = (report_received_t*) data;
+            handle_received_report(msg->report, len - sizeof(report_received_t), (uint16_t) (msg->dev_addr << 8) | msg->interface);
+            ret = true;
+            break;
+        }
+        case DualCommand::GET_FEATURE_RESPONSE: {
+            get_feature_response_t* msg = (get_feature_response_t*) data;
+            handle_get_report_response((uint16_t) (msg->dev_addr << 8) | msg->interface, msg->report_id, msg->report, len - sizeof(get_feature_response_t));
+            break;
+        }
+        case DualCommand::SET_FEATURE_COMPLETE: {
+            set_feature_complete_t* msg = (set_feature_complete_t*) data;
+            handle_set_report_complete((uint16_t) (msg->dev_addr << 8) | msg->interface, msg->report_id);
+            break;
+        }
+        case DualCommand::MIDI_RECEIVED: {
+            midi_received_t* msg = (midi_received_t*) data;
+            handle_received_midi(msg->hub_port, msg->msg);
+            ret = true;
+            break;
+        }
+        default:
+            break;
+    }
+    return ret;
+}
+
+void extra_init() {
+    multicore_launch_core1(core1_main);
+    // wait for core1 to bring up the host stack so that tusb_init() doesn't do it here
+    multicore_fifo_pop_blocking();
+}
+
+uint32_t get_gpio_valid_pins_mask() {
+    return GPIO_VALID_PINS_BASE & ~(
+#ifdef PICO_DEFAULT_UART_TX_PIN
+                                      (1 << PICO_DEFAULT_UART_TX_PIN) |
+#endif
+#ifdef PICO_DEFAULT_UART_RX_PIN
+                                      (1 << PICO_DEFAULT_UART_RX_PIN) |
+#endif
+                                      (1 << PICO_DEFAULT_PIO_USB_DP_PIN) |
+                                      (1 << (PICO_DEFAULT_PIO_USB_DP_PIN + 1)));
+}
+
+void read_report(bool* new_report, bool* tick) {
+    *tick = get_and_clear_tick_pending();
+
+    // mounts go first so that a new device's descriptor is parsed before its reports
+    spsc_ring_read(to_core0_control, core0_callback);
+    *new_report = spsc_ring_read(to_core0_reports, core0_callback);
+}
+
+void interval_override_updated() {
+}
+
+void flash_b_side() {
+}
+
+// Everything below runs on core1, except for the queue_* functions.
+
+void descriptor_received_callback(uint16_t vendor_id, uint16_t product_id, const uint8_t* report_descriptor, int len, uint16_t interface, uint8_t hub_port, uint8_t itf_num) {
+    device_connected_t* msg = (device_connected_t*) core1_buffer;
+    if (len > SPSC_RING_MAX_MSG - (int) sizeof(device_connected_t)) {
+        printf("report descriptor too long\n");
+        len = SPSC_RING_MAX_MSG - sizeof(device_connected_t);
+    }
+    msg->command = DualCommand::DEVICE_CONNECTED;
+    msg->vid = vendor_id;
+    msg->pid = product_id;
+    msg->dev_addr = (interface >> 8) & 0xFF;
+    msg->interface = interface & 0xFF;
+    msg->hub_port = hub_port;
+    msg->itf_num = itf_num;
+    memcpy(msg->report_descriptor, report_descriptor, len);
+    spsc_ring_write(to_core0_control, (uint8_t*) msg, len + sizeof(device_connected_t));
+}
+
+// The device stack and the config code on core0 own cloned_device and
+// interval_override, core1 only asks the device for its descriptors.
+static void send_device_identity(uint8_t dev_addr, uint16_t vid, uint16_t pid) {
+    cloned_device_info_t info;
+    read_device_identity(dev_addr, vid, pid, info);
+
+    device_identity_t* msg = (device_identity_t*) core1_buffer;
+    msg->command = DualCommand::DEVICE_IDENTITY;
+    msg->interval_override = CLONED_DEVICE_INTERVAL;
+    msg->vid = info.vid;
+    msg->pid = info.pid;
+    msg->bcd_device = info.bcd_device;
+    memcpy(msg->manufacturer, info.manufacturer, sizeof(msg->manufacturer));
+    memcpy(msg->product, info.product, sizeof(msg->product));
+    memcpy(msg->serial_number, info.serial_number, sizeof(msg->serial_number));
+    spsc_ring_write(to_core0_control, (uint8_t*) msg, sizeof(device_identity_t));
+}
+
+void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_report, uint16_t desc_len) {
+    printf("tuh_hid_mount_cb\n");
+
+    uint8_t hub_addr;
+    uint8_t hub_port;
+    tuh_get_hub_addr_port(dev_addr, &hub_addr, &hub_port);
+
+    uint16_t vid;
+    uint16_t pid;
+    tuh_vid_pid_get(dev_addr, &vid, &pid);
+
+    tuh_itf_info_t itf_info;
+    tuh_hid_itf_get_info(dev_addr, instance, &itf_info);
+    uint8_t itf_num = itf_info.desc.bInterfaceNumber;
+
+    send_device_identity(dev_addr, vid, pid);
+
+    descriptor_received_callback(vid, pid, desc_report, desc_len, (uint16_t) (dev_addr << 8) | instance, hub_port, itf_num);
+
+    tuh_hid_receive_report(dev_addr, instance);
+}
+
+void umount_callback(uint8_t dev_addr, uint8_t instance) {
+    device_disconnected_t msg;
+    msg.dev_addr = dev_addr;
+    msg.interface = instance;
+    spsc_ring_write(to_core0_control, (uint8_t*) &msg, sizeof(msg));
+}
+
+void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance) {
+    printf("tuh_hid_umount_cb\n");
+    umount_callback(dev_addr, instance);
+}
+
+void report_received_callback(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len) {
+    if (len > 0) {
+        report_received_t* msg = (report_received_t*) core1_buffer;
+        msg->command = DualCommand::REPORT_RECEIVED;
+        msg->dev_addr = dev_addr;
+        msg->interface = instance;
+        memcpy(msg->report, report, len);
+        spsc_ring_write(to_core0_reports, (uint8_t*) msg, len + sizeof(report_received_t), true);
+    }
+}
+
+void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len) {
+    report_received_callback(dev_addr, instance, report, len);
+
+    tuh_hid_receive_report(dev_addr, instance);
+}
+
+void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets) {
+    uint8_t hub_addr;
+    uint8_t hub_port;
+    tuh_get_hub_addr_port(dev_addr, &hub_addr, &hub_port);
+
+    midi_received_t* msg = (midi_received_t*) core1_buffer;
+    msg->command = DualCommand::MIDI_RECEIVED;
+    msg->hub_port = hub_port;
+    while (tuh_midi_packet_read(dev_addr, msg->msg)) {
+        spsc_ring_write(to_core0_reports, (uint8_t*) msg, sizeof(midi_received_t), true);
+    }
+}
+
+void get_report_cb(uint8_t dev_addr, uint8_t interface, uint8_t report_id, uint8_t report_type, uint8_t* report, uint16_t len) {
+    get_feature_response_t* msg = (get_feature_response_t*) core1_buffer;
+    msg->command = DualCommand::GET_FEATURE_RESPONSE;
+    msg->dev_addr = dev_addr;
+    msg->interface = interface;
+    msg->report_id = report_id;
+    memcpy(msg->report, report, len);
+    spsc_ring_write(to_core0_control, (uint8_t*) msg, len + sizeof(get_feature_response_t));
+}
+
+void set_report_complete_cb(uint8_t dev_addr, uint8_t interface, uint8_t report_id) {
+    set_feature_complete_t* msg = (set_feature_complete_t*) core1_buffer;
+    msg->command = DualCommand::SET_FEATURE_COMPLETE;
+    msg->dev_addr = dev_addr;
+    msg->interface = interface;
+    msg->report_id = report_id;
+    spsc_ring_write(to_core0_control, (uint8_t*) msg, sizeof(set_feature_complete_t));
+}
+
+void queue_out_report(uint16_t interface, uint8_t report_id, const uint8_t* report, uint8_t len) {
+    send_out_report_t* msg = (send_out_report_t*) core0_buffer;
+    msg->command = DualCommand::SEND_OUT_REPORT;
+    msg->dev_addr = interface >> 8;
+    msg->interface = interface & 0xFF;
+    msg->report_id = report_id;
+    memcpy(msg->report, report, len);
+    spsc_ring_write(to_core1, (uint8_t*) msg, len + sizeof(send_out_report_t));
+}
+
+void queue_set_feature_report(uint16_t interface, uint8_t report_id, const uint8_t* report, uint8_t len) {
+    set_feature_report_t* msg = (set_feature_report_t*) core0_buffer;
+    msg->command = DualCommand::SET_FEATURE_REPORT;
+    msg->dev_addr = interface >> 8;
+    msg->interface = interface & 0xFF;
+    msg->report_id = report_id;
+    memcpy(msg->report, report, len);
+    spsc_ring_write(to_core1, (uint8_t*) msg, len + sizeof(set_feature_report_t));
+}
+
+void queue_get_feature_report(uint16_t interface, uint8_t report_id, uint8_t len) {
+    get_feature_report_t* msg = (get_feature_report_t*) core0_buffer;
+    msg->command = DualCommand::GET_FEATURE_REPORT;
+    msg->dev_addr = interface >> 8;
+    msg->interface = interface & 0xFF;
+    msg->report_id = report_id;
+    msg->len = len;
+    spsc_ring_write(to_core1, (uint8_t*) msg, sizeof(get_feature_report_t));
+}
+
+void send_out_report() {
+}
+
+void __no_inline_not_in_flash_func(sof_callback)() {
+    tick_sof();
+}
@@ -146,5 +146,7 @@ void send_out_report() {
 }
 
 void sof_callback() {
-    set_tick_pending();
+    if (!tick_sof()) {
+        set_tick_pending();
+    }
 }
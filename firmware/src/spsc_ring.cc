@@ -0,0 +1,54 @@
+#include <cstring>
+
+#include "spsc_ring.h"
+
+static void copy_in(spsc_ring_t& ring, uint32_t pos, const uint8_t* data, uint16_t len) {
+    uint32_t offset = pos % SPSC_RING_SIZE;
+    uint32_t first = (len < SPSC_RING_SIZE - offset) ? len : SPSC_RING_SIZE - offset;
+    memcpy(ring.buffer + offset, data, first);
+    memcpy(ring.buffer, data + first, len - first);
+}
+
+static void copy_out(spsc_ring_t& ring, uint32_t pos, uint8_t* data, uint16_t len) {
+    uint32_t offset = pos % SPSC_RING_SIZE;
+    uint32_t first = (len < SPSC_RING_SIZE - offset) ? len : SPSC_RING_SIZE - offset;
+    memcpy(data, ring.buffer + offset, first);
+    memcpy(data + first, ring.buffer, len - first);
+}
+
+// Blocks until there's room unless drop_if_full is set.
+bool spsc_ring_write(spsc_ring_t& ring, const uint8_t* data, uint16_t len, bool drop_if_full) {
+    if (len > SPSC_RING_MAX_MSG) {
+        return false;
+    }
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    while (SPSC_RING_SIZE - (head - ring.tail.load(std::memory_order_acquire)) < (uint32_t) len + 2) {
+        if (drop_if_full) {
+            return false;
+        }
+    }
+    uint8_t len_bytes[2] = { (uint8_t) (len & 0xFF), (uint8_t) (len >> 8) };
+    copy_in(ring, head, len_bytes, 2);
+    copy_in(ring, head + 2, data, len);
+    ring.head.store(head + 2 + len, std::memory_order_release);
+    return true;
+}
+
+// Calls callback for every message in the ring, returns true if any of
+// the calls did.
+bool spsc_ring_read(spsc_ring_t& ring, ring_msg_cb_t callback) {
+    bool ret = false;
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint32_t head = ring.head.load(std::memory_order_acquire);
+    while (tail != head) {
+        uint8_t len_bytes[2];
+        copy_out(ring, tail, len_bytes, 2);
+        uint16_t len = len_bytes[0] | (len_bytes[1] << 8);
+        copy_out(ring, tail + 2, ring.msg, len);
+        tail += 2 + len;
+        // free the space before handling the message so the producer isn't held up
+        ring.tail.store(tail, std::memory_order_release);
+        ret |= callback(ring.msg, len);
+    }
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdint.h>
+#include <atomic>
+
+// Message ring with exactly one producer and one consumer, for passing
+// messages between the two cores without locks. Each message is stored
+// with a two byte length prefix and may wrap around the end of the buffer.
+
+#define SPSC_RING_SIZE 4096  // must be a power of two
+#define SPSC_RING_MAX_MSG 528
+
+typedef bool (*ring_msg_cb_t)(const uint8_t* data, uint16_t len);
+
+struct spsc_ring_t {
+    std::atomic<uint32_t> head{ 0 };  // only written by the producer
+    std::atomic<uint32_t> tail{ 0 };  // only written by the consumer
+    uint8_t buffer[SPSC_RING_SIZE];
+    uint8_t msg[SPSC_RING_MAX_MSG];  // consumer's copy of the current message
+};
+
+bool spsc_ring_write(spsc_ring_t& ring, const uint8_t* data, uint16_t len, bool drop_if_full = false);
+bool spsc_ring_read(spsc_ring_t& ring, ring_msg_cb_t callback);
+
+#endif
@@ -2,11 +2,24 @@
 
 #include <pico/critical_section.h>
 #include <pico/platform.h>
+#include <pico/time.h>
+
+#include "globals.h"
+
+#define FRAME_LENGTH_US 1000
 
 static critical_section_t crit_sec;
 
 static volatile bool tick_pending = false;
 
+static volatile uint32_t last_sof_time = 0;
+static volatile uint32_t tick_fire_time = 0;
+static volatile bool aligned_tick_fired = false;
+
+static bool host_poll_phase_known = false;
+static int32_t host_poll_phase_x8 = 0;
+static uint32_t processing_time_x64 = 0;
+
 void tick_init() {
     critical_section_init(&crit_sec);
 }
@@ -24,3 +37,83 @@ bool get_and_clear_tick_pending() {
     critical_section_exit(&crit_sec);
     return tmp;
 }
+
+static int64_t __no_inline_not_in_flash_func(aligned_tick_callback)(alarm_id_t id, void* user_data) {
+    tick_fire_time = time_us_32();
+    aligned_tick_fired = true;
+    set_tick_pending();
+    return 0;
+}
+
+// Called on every SOF we get from the host. Returns true if it scheduled
+// the tick, otherwise the caller keeps using its fixed timing.
+bool __no_inline_not_in_flash_func(tick_sof)() {
+    last_sof_time = time_us_32();
+    tick_alignment_active = (tick_margin != 0) && host_poll_phase_known;
+    if (!tick_alignment_active) {
+        return false;
+    }
+    add_alarm_in_us(tick_offset, aligned_tick_callback, NULL, true);
+    return true;
+}
+
+// False when we're not getting SOFs (suspended, not mounted) so the
+// fixed rate timers have to keep ticking.
+bool __no_inline_not_in_flash_func(tick_aligned)() {
+    return tick_alignment_active && (time_us_32() - last_sof_time < 2 * FRAME_LENGTH_US);
+}
+
+static void update_tick_offset() {
+    int32_t offset = ((int32_t) host_poll_phase - (int32_t) (processing_time_x64 / 64) - tick_margin * 10) % FRAME_LENGTH_US;
+    if (offset < 0) {
+        offset += FRAME_LENGTH_US;
+    }
+    tick_offset = offset;
+}
+
+// Called when the host picked up a report from our IN endpoint. It's
+// called from tud_task() so it's a little late, the margin covers that.
+void tick_in_complete() {
+    int32_t phase = (time_us_32() - last_sof_time) % FRAME_LENGTH_US;
+    if (!host_poll_phase_known) {
+        host_poll_phase_x8 = phase * 8;
+        host_poll_phase_known = true;
+    } else {
+        // phase wraps around so move towards the new value the short way
+        int32_t diff = phase * 8 - host_poll_phase_x8;
+        if (diff >= FRAME_LENGTH_US * 4) {
+            diff -= FRAME_LENGTH_US * 8;
+        } else if (diff < -FRAME_LENGTH_US * 4) {
+            diff += FRAME_LENGTH_US * 8;
+        }
+        host_poll_phase_x8 += diff / 8;
+        if (host_poll_phase_x8 < 0) {
+            host_poll_phase_x8 += FRAME_LENGTH_US * 8;
+        } else if (host_poll_phase_x8 >= FRAME_LENGTH_US * 8) {
+            host_poll_phase_x8 -= FRAME_LENGTH_US * 8;
+        }
+    }
+    host_poll_phase = host_poll_phase_x8 / 8;
+    update_tick_offset();
+}
+
+// Called after the tick's report has been handed to the USB stack.
+void tick_processed() {
+    if (!aligned_tick_fired) {
+        return;
+    }
+    aligned_tick_fired = false;
+    uint32_t elapsed = time_us_32() - tick_fire_time;
+    if (elapsed >= FRAME_LENGTH_US) {
+        return;
+    }
+    uint32_t elapsed_x64 = elapsed * 64;
+    // follow increases right away, back off slowly
+    if (elapsed_x64 > processing_time_x64) {
+        processing_time_x64 = elapsed_x64;
+    } else {
+        processing_time_x64 -= (processing_time_x64 - elapsed_x64) / 64;
+    }
+    tick_to_report_time = processing_time_x64 / 64;
+    update_tick_offset();
+}
@@ -11,6 +11,11 @@ void tick_init();
 void set_tick_pending();
 bool get_and_clear_tick_pending();
 
+bool tick_sof();
+bool tick_aligned();
+void tick_in_complete();
+void tick_processed();
+
 #ifdef __cplusplus
 }
 #endif
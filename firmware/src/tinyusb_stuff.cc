@@ -31,6 +31,7 @@
 #include "our_descriptor.h"
 #include "platform.h"
 #include "remapper.h"
+#include "tick.h"
 
 // These IDs are bogus. If you want to distribute any hardware using this,
 // you will have to get real ones.
@@ -235,6 +236,13 @@ void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t rep
     }
 }
 
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len) {
+    if (instance == 0) {
+        tick_in_complete();
+        report_delivered();
+    }
+}
+
 void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol) {
     printf("tud_hid_set_protocol_cb %d %d\n", instance, protocol);
     boot_protocol_keyboard = (protocol == HID_PROTOCOL_BOOT);
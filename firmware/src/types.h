@@ -3,8 +3,11 @@
 
 #include <stdint.h>
 #include <cstddef>
+#include <unordered_map>
 #include <vector>
 
+#include "bits.h"
+
 enum class ConfigCommand : int8_t {
     NO_COMMAND = 0,
     RESET_INTO_BOOTSEL = 1,
@@ -32,6 +35,17 @@ enum class ConfigCommand : int8_t {
     CLEAR_QUIRKS = 23,
     ADD_QUIRK = 24,
     GET_QUIRK = 25,
+    GET_LATENCY_SAVED = 26,
+    GET_TICK_ALIGNMENT = 27,
+    GET_OUTPUT_QUEUE_STATS = 28,
+    GET_LATENCY_HISTOGRAM = 29,
+    RESET_LATENCY_HISTOGRAMS = 30,
+    GET_PROFILE = 31,
+    RESET_PROFILE = 32,
+    GET_EXPRESSION_STATS = 33,
+    RESET_EXPRESSION_STATS = 34,
+    GET_OUTPUT_QUEUE_CONFIG = 35,
+    SET_OUTPUT_QUEUE_CONFIG = 36,
 };
 
 struct usage_def_t {
@@ -49,6 +63,7 @@ struct usage_def_t {
     int32_t* input_state_0 = NULL;
     int32_t* input_state_n = NULL;
     uint8_t index_mask = 0;
+    BitsKernel kernel = BitsKernel::GENERIC;
 };
 
 struct usage_usage_def_t {
@@ -56,6 +71,94 @@ struct usage_usage_def_t {
     usage_def_t usage_def;
 };
 
+#define NO_REPORT_DECODE 0xFF
+#define NO_DECODED_ARRAY 0xFF
+#define NO_RANGE_TABLE 0xFFFFFFFF
+#define NO_RANGE_STATE 0xFFFF
+#define MAX_DECODED_ARRAYS 8
+#define NO_PASSTHROUGH 0xFF
+#define MAX_RANGE_TABLE 1024
+
+struct field_decode_t {
+    uint32_t usage;
+    usage_def_t usage_def;
+    uint8_t decoded_array = NO_DECODED_ARRAY;  // array usages: which of the report's decoded arrays to look in
+    uint32_t range_start = NO_RANGE_TABLE;     // array ranges: (index - logical_minimum) -> range_slots[range_start + ...]
+};
+
+// Array field that gets decoded into a bitset of the indexes present, once per report.
+struct array_field_t {
+    uint16_t bitpos;
+    uint8_t size;  // at most 8 bits, so the bitset is 256 bits
+    uint32_t count;
+    BitsKernel kernel;
+};
+
+struct range_state_t {
+    int32_t* state_ptr_0;
+    int32_t* state_ptr_n;
+};
+
+// Up to 32 consecutive 1-bit buttons, read with one get_bits() call. Only
+// buttons whose value changed since the previous report get written.
+struct button_run_t {
+    uint16_t bitpos;
+    uint8_t size;
+    uint32_t mask;           // bits that are buttons
+    uint16_t buttons_start;  // into decode_tables_t::buttons, one entry per bit
+};
+
+// What a button run read from the previous report. Kept outside the decode
+// tables so that those stay read-only once published.
+struct button_run_state_t {
+    uint32_t previous = 0;
+    bool primed = false;  // previous is valid
+};
+
+// Ranges into the flat arrays in decode_tables_t.
+struct report_decode_t {
+    uint16_t fields_start;
+    uint16_t fields_end;
+    uint16_t array_ranges_start;
+    uint16_t array_ranges_end;
+    uint16_t rollover_start;
+    uint16_t rollover_end;
+    uint16_t array_fields_start;
+    uint16_t array_fields_end;
+    uint16_t button_runs_start;
+    uint16_t button_runs_end;
+};
+
+struct interface_decode_t {
+    bool has_report_id;
+    uint8_t interface_index;
+    uint8_t hub_port;
+    uint16_t reports_start;    // into decode_tables_t::reports
+    uint8_t report_slot[256];  // report_id -> offset from reports_start, NO_REPORT_DECODE if none
+    bool passthrough = false;  // reports are copied to the output as they are
+};
+
+struct scroll_field_t {
+    usage_def_t usage_def;
+    uint8_t resolution_multiplier_mask;
+};
+
+struct decode_tables_t {
+    std::vector<uint16_t> interface_ids;  // dev_addr+interface, in the same order as interfaces
+    std::vector<interface_decode_t> interfaces;
+    std::vector<report_decode_t> reports;
+    std::vector<field_decode_t> fields;
+    std::vector<int32_t*> array_range_states;
+    std::vector<usage_def_t> rollover_fields;
+    std::vector<array_field_t> array_fields;
+    std::vector<uint16_t> range_slots;  // index into range_states, NO_RANGE_STATE if unmapped
+    std::vector<range_state_t> range_states;
+    std::vector<button_run_t> button_runs;
+    std::vector<range_state_t> buttons;
+    uint8_t passthrough_interface = NO_PASSTHROUGH;  // index into interfaces
+    std::vector<scroll_field_t> passthrough_scroll;  // scaled when the host enables hi-res scrolling
+};
+
 enum class Op : int8_t {
     PUSH = 0,
     PUSH_USAGE = 1,
@@ -112,6 +215,27 @@ enum class Op : int8_t {
     PREV_INPUT_STATE_SCALED = 52,
     DEADZONE = 53,
     DEADZONE2 = 54,
+
+    // only produced by compile_expressions(), never valid in a config
+    LOAD_INPUT_STATE = 100,
+    LOAD_INPUT_STATE_BINARY = 101,
+    LOAD_INPUT_STATE_SCALED = 102,
+    LOAD_INPUT_STATE_FP32 = 103,
+    LOAD_PREV_INPUT_STATE = 104,
+    LOAD_PREV_INPUT_STATE_BINARY = 105,
+    LOAD_PREV_INPUT_STATE_SCALED = 106,
+    LOAD_PREV_INPUT_STATE_FP32 = 107,
+    LOAD_STICKY_STATE = 108,
+    LOAD_TAP_STATE = 109,
+    LOAD_HOLD_STATE = 110,
+    ADD_CONST = 111,
+    SUB_CONST = 112,
+    MUL_CONST = 113,
+    DIV_CONST = 114,
+    EQ_CONST = 115,
+    GT_CONST = 116,
+    LT_CONST = 117,
+    DEADZONE_CONST = 118,
 };
 
 struct tap_hold_state_t {
@@ -130,6 +254,20 @@ struct expr_elem_t {
     };
 };
 
+struct expr_input_t {
+    const void* ptr;
+    bool byte;
+    int32_t value;  // as of the last evaluation
+};
+
+struct expr_schedule_t {
+    bool always;        // reads something we can't watch
+    bool side_effects;  // evaluated even if nothing reads the result
+    bool evaluated;
+    int32_t* result = NULL;
+    std::vector<expr_input_t> inputs;
+};
+
 struct map_source_t {
     uint32_t usage;
     int32_t scaling = 1000;  // * 1000
@@ -143,8 +281,6 @@ struct map_source_t {
     int32_t* input_state;
     tap_hold_state_t* tap_hold_state;
     uint8_t* sticky_state;
-    int32_t accumulated_scroll;
-    uint64_t last_scroll_timestamp;  // XXX we can make this 32 or less bits
 };
 
 struct out_usage_def_t {
@@ -165,6 +301,85 @@ struct reverse_mapping_t {
     std::vector<map_source_t> sources;
 };
 
+// What a source contributes to its target. Picked once when the mapping
+// program is compiled so that process_mapping() doesn't have to look at
+// usage pages and flags on every frame.
+enum class SourceOp : uint8_t {
+    STICKY = 0,
+    TAP_HOLD = 1,
+    BINARY = 2,
+    VALUE = 3,
+    VALUE_SCALED = 4,        // expressions and registers, value is * 1000
+    RELATIVE_AS_BINARY = 5,  // relative input mapped to an absolute output
+};
+
+enum class TargetOp : uint8_t {
+    RELATIVE = 0,
+    SCROLL = 1,
+    ABSOLUTE = 2,
+    REGISTER = 3,
+};
+
+struct bit_writer_t {
+    uint8_t* data;
+    uint16_t len;
+    uint8_t size;
+    uint16_t bitpos;
+    BitsKernel kernel;
+    uint8_t array_count;
+    uint32_t array_index;
+    uint32_t max_value;
+};
+
+// For one layer_state_mask: the sources of each target that can contribute
+// on those layers. Sticky sources are always there.
+struct layer_table_t {
+    std::vector<uint16_t> target_sources_end;
+    std::vector<uint16_t> sources;
+};
+
+// reverse_mapping flattened into tables. Sources of target N are
+// [target_sources_end[N-1], target_sources_end[N]), same for writers.
+struct mapping_program_t {
+    std::vector<SourceOp> source_op;
+    std::vector<uint8_t> source_flags;
+    std::vector<uint8_t> source_layer_mask;
+    std::vector<uint16_t> source_port_mask;
+    std::vector<uint16_t> source_slot;
+    std::vector<int32_t> source_param;  // scaling, or precomputed delta for on/off sources
+    std::vector<int32_t> source_accumulated_scroll;
+    std::vector<uint64_t> source_last_scroll_timestamp;  // XXX we can make this 32 or less bits
+
+    std::vector<uint32_t> target_usage;
+    std::vector<TargetOp> target_op;
+    std::vector<int32_t> target_default_value;
+    std::vector<uint16_t> target_sources_end;
+    std::vector<uint16_t> target_writers_end;
+    std::vector<uint32_t> target_dirty;  // bitset, target has to be evaluated again
+    std::vector<uint32_t> auto_repeat_targets;  // bitset, relative targets with sources that only count on auto_repeat frames
+    std::vector<int32_t> target_value;   // absolute: last value, relative: non-zero if it moved last time
+    std::vector<uint16_t> target_accumulator;  // relative targets only
+
+    std::vector<bit_writer_t> writers;
+
+    // relative movement, one per distinct relative target usage
+    std::vector<uint32_t> accumulator_usage;
+    std::vector<usage_def_t> accumulator_field;  // where it goes in our reports
+    std::vector<int32_t> accumulator_value;      // * 1000
+
+    // input_state slot -> targets that read it, same layout as above
+    std::vector<uint16_t> slot_targets_end;
+    std::vector<uint16_t> slot_targets;
+
+    // macro -> steps -> writers, same layout again
+    std::vector<uint16_t> macro_steps_end;
+    std::vector<uint16_t> macro_step_writers_end;
+    std::vector<bit_writer_t> macro_writers;
+
+    // for the current layer_state_mask, refilled in place when it changes
+    layer_table_t layer_table;
+};
+
 struct tap_hold_usage_t {
     int32_t* input_state;
     tap_hold_state_t* tap_hold_state;
@@ -183,6 +398,40 @@ struct tap_hold_sticky_usage_t {
     uint8_t* sticky_state;
 };
 
+#define NO_BINARY_SOURCE 0xFFFF
+
+// Bitsets over input_state slots for the tap-hold, sticky and layer logic,
+// so that process_mapping() only looks at sources that could have changed.
+struct binary_sources_t {
+    uint32_t words = 0;
+    std::vector<uint32_t> tap_hold_slots;
+    std::vector<uint32_t> sticky_slots;
+    std::vector<uint32_t> tap_sticky_slots;
+    std::vector<uint32_t> hold_sticky_slots;
+    std::vector<uint32_t> layer_source_slots;
+    std::vector<uint32_t> any_source_slots;  // all of the above
+
+    // Expressions and registers update their slots after this logic runs and
+    // those bits are cleared from dirty_slots in the same frame, so they're
+    // carried over to the next one.
+    std::vector<uint32_t> carried_dirty;
+
+    std::vector<uint32_t> tap_hold_settling;  // tap is set or hold changed, has to be evaluated next frame
+    std::vector<uint32_t> tap_hold_waiting;   // pressed, not held long enough yet
+    uint64_t tap_hold_deadline = 0;           // earliest time a waiting one can turn into a hold
+    std::vector<uint32_t> taps;               // this frame
+    std::vector<uint32_t> hold_starts;        // this frame
+
+    // slot -> index into tap_hold_usages etc., NO_BINARY_SOURCE if none
+    std::vector<uint16_t> tap_hold_index;
+    std::vector<uint16_t> sticky_index;
+    std::vector<uint16_t> tap_sticky_index;
+    std::vector<uint16_t> hold_sticky_index;
+
+    bool layers_dirty = true;
+    uint8_t layers_computed_for = 0;  // layer_state_mask the layers were last computed with
+};
+
 struct usage_rle_t {
     uint32_t usage;
     uint32_t count;
@@ -312,7 +561,22 @@ typedef persist_config_v12_t persist_config_v13_t;
 
 typedef persist_config_v13_t persist_config_v18_t;
 
-typedef persist_config_v18_t persist_config_t;
+struct __attribute__((packed)) persist_config_v19_t {
+    uint8_t version;
+    uint8_t flags;
+    uint8_t unmapped_passthrough_layer_mask;
+    uint32_t partial_scroll_timeout;
+    uint16_t mapping_count;
+    uint8_t interval_override;
+    uint32_t tap_hold_threshold;
+    uint8_t gpio_debounce_time_ms;
+    uint8_t our_descriptor_number;
+    uint8_t macro_entry_duration;
+    uint16_t quirk_count;
+    uint8_t tick_margin;
+};
+
+typedef persist_config_v19_t persist_config_t;
 
 struct __attribute__((packed)) get_config_t {
     uint8_t version;
@@ -328,6 +592,7 @@ struct __attribute__((packed)) get_config_t {
     uint8_t our_descriptor_number;
     uint8_t macro_entry_duration;
     uint16_t quirk_count;
+    uint8_t tick_margin;
 };
 
 struct __attribute__((packed)) set_config_t {
@@ -339,6 +604,7 @@ struct __attribute__((packed)) set_config_t {
     uint8_t gpio_debounce_time_ms;
     uint8_t our_descriptor_number;
     uint8_t macro_entry_duration;
+    uint8_t tick_margin;
 };
 
 struct __attribute__((packed)) get_indexed_t {
@@ -434,4 +700,98 @@ struct __attribute__((packed)) uint16_val_t {
     uint16_t val;
 };
 
+struct __attribute__((packed)) latency_saved_t {
+    uint32_t immediate_runs;
+    uint64_t latency_saved_us;
+};
+
+struct __attribute__((packed)) tick_alignment_t {
+    uint8_t active;
+    uint16_t tick_offset;
+    uint16_t host_poll_phase;
+    uint16_t tick_to_report_time;
+};
+
+struct __attribute__((packed)) output_queue_stats_t {
+    uint32_t reports_merged;
+    uint32_t reports_dropped;
+};
+
+struct __attribute__((packed)) output_queue_config_t {
+    uint8_t depth;
+    uint8_t keep_latest;
+    uint8_t max_depth;  // ignored in SET_OUTPUT_QUEUE_CONFIG
+};
+
+struct __attribute__((packed)) expression_stats_t {
+    uint8_t nexpressions;
+    uint8_t expression;
+    uint32_t frames;
+    uint32_t evaluations;
+};
+
+enum class LatencyStage : uint8_t {
+    INPUT_TO_PROCESSING = 0,  // report received until process_mapping() picks it up
+    PROCESSING = 1,           // one process_mapping() call that mapped a frame
+    QUEUED = 2,               // outgoing report queued until handed to the USB stack
+    USB = 3,                  // handed to the USB stack until the host picked it up
+    END_TO_END = 4,           // report received until the host picked up the result
+    N
+};
+
+#define LATENCY_BUCKETS 32
+#define LATENCY_BUCKETS_IN_PACKET 6
+
+struct __attribute__((packed)) get_latency_histogram_t {
+    uint8_t stage;
+    uint8_t first_bucket;
+};
+
+struct __attribute__((packed)) latency_histogram_t {
+    uint16_t bucket_width_us;  // the last bucket also counts everything above it
+    uint8_t nbuckets;
+    uint8_t first_bucket;
+    uint32_t counts[LATENCY_BUCKETS_IN_PACKET];
+};
+
+enum class ProfileStage : uint8_t {
+    LOOP = 0,  // one whole main loop iteration
+    READ_REPORT = 1,
+    DESCRIPTOR_UPDATE = 2,
+    READ_GPIO = 3,
+    READ_ADC = 4,
+    PROCESS_MAPPING = 5,
+    WRITE_GPIO = 6,
+    MCP4651_WRITE = 7,
+    TUD_TASK = 8,
+    SERIAL_HID_CONTROL = 9,
+    SEND_REPORT = 10,
+    SEND_OUT_REPORT = 11,
+    PERSIST_CONFIG = 12,
+    N
+};
+
+struct __attribute__((packed)) profile_stats_t {
+    uint8_t nstages;  // 0 if the firmware was built without the profiler
+    uint8_t stage;
+    uint16_t ticks_per_us;
+    uint32_t count;
+    uint32_t min;  // all durations in ticks
+    uint32_t max;
+    uint32_t avg;
+    uint32_t p99;
+    uint32_t overruns;  // loop iterations longer than 1 ms
+};
+
+// 设备克隆信息
+struct cloned_device_info_t {
+    uint16_t vid = 0;
+    uint16_t pid = 0;
+    uint16_t bcd_device = 0x0100;
+    char manufacturer[64] = {0};
+    char product[64] = {0};
+    char serial_number[64] = {0};
+    bool is_cloned = false;
+};
+
 #endif